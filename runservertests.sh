@@ -0,0 +1,43 @@
+#!/bin/sh
+
+# Renders designs through the render server and checks them against the
+# command line program, and checks that jobs can't read outside the root
+
+mkdir -p output
+sock=output/test.sock
+rm -f $sock
+./cfdg -q --serve unix:$sock --serve-root input -j 2 &
+server=$!
+trap 'kill $server 2> /dev/null' EXIT
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 ; do [ -S $sock ] && break ; sleep 0.2 ; done
+
+status=0
+check() { if [ $1 -eq 0 ] ; then echo "$2   pass" ; else echo "$2          FAIL" ; status=1 ; fi ; }
+
+./cfdg -q -v ABC -s 300 input/welcome.cfdg output/direct.png
+./cfdg-client $sock path welcome.cfdg variation ABC size 300 > output/served.png && cmp -s output/direct.png output/served.png
+check $? "path request"
+./cfdg-client $sock variation ABC size 300 < input/welcome.cfdg > output/served.png && cmp -s output/direct.png output/served.png
+check $? "text request"
+./cfdg -q -L -v ABC -s 300 input/ziggy.cfdg output/direct.png
+./cfdg-client $sock path ziggy.cfdg variation ABC size 300 legacy 1 > output/served.png && cmp -s output/direct.png output/served.png
+check $? "legacy order request"
+./cfdg -q --cull -v ABC -s 300 input/spiralarms.cfdg output/direct.png
+./cfdg-client $sock path spiralarms.cfdg variation ABC size 300 cull 1 > output/served.png && cmp -s output/direct.png output/served.png
+check $? "culled request"
+./cfdg -q --seeds split -v ABC -s 300 input/mtree.cfdg output/direct.png
+./cfdg-client $sock path mtree.cfdg variation ABC size 300 seeds split > output/served.png && cmp -s output/direct.png output/served.png
+check $? "split seeds request"
+! ./cfdg-client $sock path ../runtests.sh > /dev/null 2>&1
+check $? "path outside root"
+! ./cfdg-client $sock path /etc/passwd > /dev/null 2>&1
+check $? "absolute path outside root"
+printf 'shape B { CIRCLE [] }\n' > output/outside.cfdg
+printf 'import "../input/i_pix.cfdg"\nstartshape A\nshape A { SQUARE [] }\n' | ./cfdg-client $sock > /dev/null
+check $? "import inside root"
+! printf 'import "../output/outside.cfdg"\nstartshape B\n' | ./cfdg-client $sock > /dev/null 2>&1
+check $? "import outside root"
+[ "`ls -l $sock | cut -c1-10`" = "srwx------" ]
+check $? "socket permissions"
+
+exit $status
@@ -34,14 +34,14 @@ namespace AST {
     UIDdatatype CommandInfo::PathUIDDefault = std::numeric_limits<UIDdatatype>::max();
 
     CommandInfo::CommandInfo(unsigned i, ASTcompiledPath* path, double w, const ASTpathCommand* c)
-    : mIndex(0), mPathUID(PathUIDDefault)
+    : mIndex(0), mPathUID(PathUIDDefault), mCachedPath(false)
     {
         init(i, path, w, c);
     }
     
     CommandInfo::CommandInfo(unsigned i, agg::path_storage* path)
     : mFlags(CF_MITER_JOIN + CF_BUTT_CAP + CF_FILL), mMiterLimit(4.0), 
-      mStrokeWidth(0.1), mIndex(i), mPath(path), mPathUID(0)
+      mStrokeWidth(0.1), mIndex(i), mPath(path), mPathUID(0), mCachedPath(false)
     {
     }
     
@@ -50,7 +50,8 @@ namespace AST {
     {
         // Try to change the path UID from the default value to a value that is 
         // guaranteed to not be in use. If successful then perform initialization
-        if (mPathUID.compare_exchange_strong(PathUIDDefault, 0ULL))
+        UIDdatatype expected = PathUIDDefault;
+        if (mPathUID.compare_exchange_strong(expected, 0ULL))
             init(i, path, w, c);
     }
 
@@ -76,13 +77,13 @@ namespace AST {
     CommandInfo::CommandInfo(CommandInfo&& from) noexcept
     : mFlags(from.mFlags), mMiterLimit(from.mMiterLimit),
       mStrokeWidth(from.mStrokeWidth), mIndex(from.mIndex), mPath(from.mPath),
-      mPathUID(from.mPathUID.load())
+      mPathUID(from.mPathUID.load()), mCachedPath(from.mCachedPath)
     { }
 
     CommandInfo::CommandInfo(const CommandInfo& from)
     : mFlags(from.mFlags), mMiterLimit(from.mMiterLimit),
       mStrokeWidth(from.mStrokeWidth), mIndex(from.mIndex), mPath(from.mPath),
-      mPathUID(from.mPathUID.load())
+      mPathUID(from.mPathUID.load()), mCachedPath(from.mCachedPath)
     { }
     
     CommandInfo&
@@ -95,6 +96,7 @@ namespace AST {
         mIndex = from.mIndex;
         mPath = from.mPath;
         mPathUID = from.mPathUID.load();
+        mCachedPath = from.mCachedPath;
         return *this;
     }
     
@@ -108,6 +110,7 @@ namespace AST {
         mIndex = from.mIndex;
         mPath = from.mPath;
         mPathUID = from.mPathUID.load();
+        mCachedPath = from.mCachedPath;
         return *this;
     }
     
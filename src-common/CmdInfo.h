@@ -50,6 +50,7 @@ namespace AST {
         unsigned            mIndex;
         agg::path_storage*  mPath;
         UIDtype             mPathUID;
+        bool                mCachedPath;    // its path is drawn again unchanged
         static UIDdatatype  PathUIDDefault;
         
         static const CommandInfo
@@ -57,13 +58,13 @@ namespace AST {
         
         CommandInfo() 
         : mFlags(0), mMiterLimit(4.0), mStrokeWidth(0.1), mIndex(0), mPath(nullptr), 
-          mPathUID(PathUIDDefault) {};
+          mPathUID(PathUIDDefault), mCachedPath(false) {};
         CommandInfo(unsigned i, ASTcompiledPath* path, double w, const ASTpathCommand* c = nullptr);
         CommandInfo(CommandInfo&&) noexcept;
         CommandInfo(const CommandInfo&);
         CommandInfo(agg::path_storage* p)
         : mFlags(CF_MITER_JOIN + CF_BUTT_CAP + CF_FILL), mMiterLimit(4.0),
-          mStrokeWidth(0.1), mIndex(0), mPath(p), mPathUID(0) {}
+          mStrokeWidth(0.1), mIndex(0), mPath(p), mPathUID(0), mCachedPath(false) {}
         CommandInfo& operator=(const CommandInfo&);
         CommandInfo& operator=(CommandInfo&&) noexcept;
         void tryInit(unsigned i, ASTcompiledPath* path, double w, const ASTpathCommand* c = nullptr);
@@ -25,6 +25,7 @@
 
 #include "Rand64.h"
 #include "myrandom.h"
+#include <algorithm>
 
 Rand64 Rand64::Common;
 
@@ -147,6 +148,87 @@ int64_t Rand64::getDiscrete(unsigned count, const double* weights)
     return sd(mSeed);
 }
 
+void Rand64::fill(result_type* out, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        out[i] = mSeed();
+}
+
+namespace {
+    const std::size_t BlockSize = 64;
+
+    // Feeds the distributions in myrandom.h from draws that are made in
+    // blocks, so that they do the same arithmetic as the single-sample
+    // functions. When it runs out it draws a block of at most mNeeded,
+    // which the caller sets to a number of draws that the remaining samples
+    // are certain to use.
+    class RawBlock {
+    public:
+        using result_type = Rand64::result_type;
+
+        explicit RawBlock(Rand64& r) : mRand(r) { }
+
+        std::size_t mNeeded = 0;
+
+        result_type operator()()
+        {
+            if (mNext == mEnd) {
+                mEnd = std::min(mNeeded, BlockSize);
+                mNext = 0;
+                mRand.fill(mRaw, mEnd);
+            }
+            return mRaw[mNext++];
+        }
+
+        static myConstExpr result_type min() { return XORshift64star::min(); }
+        static myConstExpr result_type max() { return XORshift64star::max(); }
+
+    private:
+        Rand64&         mRand;
+        result_type     mRaw[BlockSize];
+        std::size_t     mNext = 0;
+        std::size_t     mEnd = 0;
+    };
+}
+
+void Rand64::getDoubles(double* out, std::size_t n)
+{
+    // Scaling by a power of two is exact, so this matches the ldexp() in
+    // getDouble()
+    const double scale = std::ldexp(1.0, -52);
+    result_type raw[BlockSize];
+    while (n) {
+        std::size_t block = std::min(n, BlockSize);
+        fill(raw, block);
+        for (std::size_t i = 0; i < block; ++i)
+            out[i] = static_cast<double>(raw[i] & 0xfffffffffffffULL) * scale;
+        out += block;
+        n -= block;
+    }
+}
+
+void Rand64::getExponentials(double lambda, double* out, std::size_t n)
+{
+    CF::exponential_distribution<double> ed(pos(lambda));
+    RawBlock block(*this);
+    for (std::size_t i = 0; i < n; ++i) {
+        block.mNeeded = n - i;
+        out[i] = ed(block);
+    }
+}
+
+void Rand64::getNormals(double mean, double stddev, double* out, std::size_t n)
+{
+    // The polar method takes a variable number of draws, and the compiler
+    // can fuse its multiply-adds differently in a different instantiation,
+    // so the samples come from the same distribution code and generator as
+    // getNormal(). getNormal() makes a new distribution for each sample, so
+    // the second value of each pair is thrown away here too.
+    for (std::size_t i = 0; i < n; ++i) {
+        CF::normal_distribution<double> nd(mean, stddev);
+        out[i] = nd(mSeed);
+    }
+}
 
 void Rand64::xorChar(unsigned char c, unsigned i)
 {
@@ -28,6 +28,7 @@
 
 #include "xorshift64star.h"
 #include <cmath>
+#include <cstddef>
 
 class Rand64 {
 public:
@@ -77,12 +78,32 @@ public:
     double getStudentT(double freedom);
     
     int64_t getDiscrete(unsigned count, const double* weights);
+
+    // Fill out[0..n) with the samples that n calls to getDouble(),
+    // getExponential() or getNormal() would return, leaving the seed in the
+    // same state that those calls would
+    void getDoubles(double* out, std::size_t n);
+    void getExponentials(double lambda, double* out, std::size_t n);
+    void getNormals(double mean, double stddev, double* out, std::size_t n);
+
+    // Put the next n draws in out, in the order that operator() would
+    // return them
+    void fill(result_type* out, std::size_t n);
     
     Rand64& operator^=(const Rand64& r)
     {
         mSeed.mSeed ^= r.mSeed.mSeed;
         return *this;
     };
+
+    // Return the seed of an independent stream, which is a pure function
+    // of this seed and the stream index, without changing this seed. With
+    // split seeds each child shape's seed is split from its parent's seed
+    // by its index, instead of stepping on from its older siblings' seeds.
+    Rand64 split(result_type index) const
+    {
+        return Rand64(SplitMix(mSeed.mSeed ^ SplitMix(index + SplitMixGamma)));
+    }
     
     void seed(result_type _s = XORshift64star::RAND64_SEED)
     { mSeed.seed(_s); }
@@ -103,6 +124,18 @@ public:
     { Common.xorChar(c, i); }
 
 private:
+    enum e_consts : result_type {
+        SplitMixGamma = 0x9e3779b97f4a7c15ULL
+    };
+
+    // The SplitMix64 finalizer
+    static result_type SplitMix(result_type z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
     XORshift64star  mSeed;
     static Rand64   Common;
     double prob(double p) { return p < 0.0 ? 0.0 : p > 1.0 ? 1.0 : p; };
@@ -25,10 +25,12 @@
 
 #include "SVGCanvas.h"
 #include <assert.h>
-#include <iomanip>
 #include <math.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
 #include <iostream>
-#include <sstream>
+#include <zlib.h>
 #include "primShape.h"
 #include "ast.h"
 #include <map>
@@ -39,6 +41,127 @@
 
 using namespace std;
 
+struct SVGCanvas::gzipStream {
+    z_stream mStream;
+    bool     mOK;
+    
+    gzipStream()
+    {
+        memset(&mStream, 0, sizeof(mStream));
+        // 15 + 16 window bits asks zlib for a gzip header instead of zlib
+        mOK = deflateInit2(&mStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~gzipStream() { if (mOK) deflateEnd(&mStream); }
+    
+    void write(ostream& out, const char* data, size_t n, bool finish)
+    {
+        if (!mOK) return;
+        char zbuf[16384];
+        mStream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        mStream.avail_in = static_cast<uInt>(n);
+        do {
+            mStream.next_out = reinterpret_cast<Bytef*>(zbuf);
+            mStream.avail_out = sizeof(zbuf);
+            if (deflate(&mStream, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) {
+                mOK = false;
+                return;
+            }
+            out.write(zbuf, sizeof(zbuf) - mStream.avail_out);
+        } while (mStream.avail_out == 0);
+    }
+};
+
+void SVGCanvas::emit(const char* data, size_t n)
+{
+    if (mGzip)
+        mGzip->write(mOutput, data, n, false);
+    else
+        mOutput.write(data, n);
+}
+
+void SVGCanvas::flush(bool final)
+{
+    emit(mBuffer.get(), mBufferUsed);
+    mBufferUsed = 0;
+    if (final) {
+        if (mGzip) {
+            mGzip->write(mOutput, nullptr, 0, true);
+            mError = mError || !mGzip->mOK;
+        }
+        mOutput.flush();
+    }
+}
+
+void SVGCanvas::number(double v)
+{
+    // Eight significant digits, like %.8g but never with an exponent
+    static const double Pow10[16] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+    };
+    double a = fabs(v);
+    if (!(a >= 1e-9)) {             // also catches NaN
+        write('0');
+        return;
+    }
+    if (a >= 1e15) {
+        char big[32];
+        int n = snprintf(big, sizeof(big), "%.8g", v);
+        write(big, static_cast<size_t>(n));
+        return;
+    }
+    
+    int decimals = 7 - static_cast<int>(floor(log10(a)));
+    if (decimals < 0) decimals = 0;
+    if (decimals > 15) decimals = 15;
+    uint64_t digits = static_cast<uint64_t>(a * Pow10[decimals] + 0.5);
+    while (decimals > 0 && digits % 10 == 0) {
+        digits /= 10;
+        --decimals;
+    }
+    if (digits == 0) {
+        write('0');
+        return;
+    }
+    
+    char buf[32];
+    char* p = buf + sizeof(buf);
+    for (int i = 0; i < decimals; ++i) {
+        *--p = static_cast<char>('0' + digits % 10);
+        digits /= 10;
+    }
+    if (decimals) *--p = '.';
+    do {
+        *--p = static_cast<char>('0' + digits % 10);
+        digits /= 10;
+    } while (digits);
+    if (v < 0.0) *--p = '-';
+    write(p, static_cast<size_t>(buf + sizeof(buf) - p));
+}
+
+void SVGCanvas::color(int rgb)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    char buf[7];
+    buf[0] = '#';
+    for (int i = 6; i > 0; --i, rgb >>= 4)
+        buf[i] = hexDigits[rgb & 15];
+    write(buf, 7);
+}
+
+void SVGCanvas::transform(const agg::trans_affine& tr)
+{
+    write("transform=\"matrix(");
+    number(tr.sx);  write(' ');
+    number(tr.shy); write(' ');
+    number(tr.shx); write(' ');
+    number(tr.sy);  write(' ');
+    number(tr.tx);  write(' ');
+    number(tr.ty);
+    write(")\"");
+}
+
 void SVGCanvas::start(bool clear, const agg::rgba& bk, int width, int height)
 {
     Canvas::start(clear, bk, width, height);
@@ -52,104 +175,113 @@ void SVGCanvas::start(bool clear, const agg::rgba& bk, int width, int height)
     agg::trans_affine_translation off((mWidth - width) / 2.0, (mHeight - height) / 2.0);
     mOffset = off.premultiply(agg::trans_affine(1.0, 0.0, 0.0, -1.0, 0.0, static_cast<double>(mHeight)));
 
-    mOutput << "<?xml version=\"1.0\" standalone=\"no\"?>" << mEndline;
-    mOutput << "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" " << mEndline;
-    mOutput << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">" << mEndline;
-    mOutput << "<svg width=\"" << mWidth << "px\" height=\"" << mHeight << "px\" version=\"1.1\"";
+    write("<?xml version=\"1.0\" standalone=\"no\"?>"); write(mEndline);
+    write("<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "); write(mEndline);
+    write("\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">"); write(mEndline);
+    write("<svg width=\""); number(mWidth);
+    write("px\" height=\""); number(mHeight);
+    write("px\" version=\"1.1\"");
     indent(5);
-    mOutput << mEndline << "xmlns=\"http://www.w3.org/2000/svg\"  xmlns:xlink=\"http://www.w3.org/1999/xlink\">";
+    write(mEndline); write("xmlns=\"http://www.w3.org/2000/svg\"  xmlns:xlink=\"http://www.w3.org/1999/xlink\">");
     indent(-3);
-    mOutput << mEndline << "<defs>" << mEndline << 
-        "  <polygon id=\"TRIANGLE\" points=\"0,0.57735 -0.5,-0.288675 0.5,-0.288675\"/>" << mEndline << "</defs>";
+    write(mEndline); write("<defs>"); write(mEndline);
+    write("  <polygon id=\"TRIANGLE\" points=\"0,0.57735 -0.5,-0.288675 0.5,-0.288675\"/>");
+    write(mEndline); write("</defs>");
 
     if (mDescription) {
-        mOutput << mEndline << "<desc>";
+        write(mEndline); write("<desc>");
         indent(2);
-        mOutput << mEndline;
-        mOutput.write(mDescription, mLength);
+        write(mEndline);
+        write(mDescription, mLength);
         indent(-2);
-        mOutput << mEndline << "</desc>";
+        write(mEndline); write("</desc>");
     }
 }
 
 void SVGCanvas::end() {
     indent(-2);
-    mOutput << mEndline << "</svg>" << mEndline;
+    write(mEndline); write("</svg>"); write(mEndline);
+    flush(true);
 
-    mError = mError || !(mOutputFile.is_open() && mOutputFile.good());
-    if (mOutputFile.is_open()) mOutputFile.close();
+    if (mOutputFile.is_open()) {
+        mError = mError || !mOutputFile.good();
+        mOutputFile.close();
+    } else {
+        mError = mError || !mOutput.good();
+    }
     Canvas::end();
 }
 
 void SVGCanvas::complete(RGBA8 c, agg::trans_affine tr, int padding, 
-                         const AST::CommandInfo& attr, bool g)
+                         const AST::CommandInfo& attr, bool open)
 {
     int rgb = (c.r >> (RGBA8::base_shift - 8)) * 65536 + 
               (c.g >> (RGBA8::base_shift - 8)) * 256 + 
               (c.b >> (RGBA8::base_shift - 8));
-    const char* ending = g ? ">" : "/>";
     
     indent(padding);
-    if (!g) mOutput << mEndline;
+    write(mEndline);
 
     if (attr.mFlags & AST::CF_FILL) {
-        mOutput << "stroke=\"none\" fill=\"#" << hex << setw(6) << setfill('0') << rgb << dec << "\"" << setfill(' ');
+        write("stroke=\"none\" fill=\""); color(rgb); write('"');
         
-        if (c.a < RGBA8::base_mask) mOutput <<  " fill-opacity=\"" << c.opacity() << "\"";
+        if (c.a < RGBA8::base_mask) {
+            write(" fill-opacity=\""); number(c.opacity()); write('"');
+        }
         if (attr.mFlags & AST::CF_EVEN_ODD)
-            mOutput << " fill-rule=\"evenodd\"";
+            write(" fill-rule=\"evenodd\"");
         else
-            mOutput << " fill-rule=\"nonzero\"";
+            write(" fill-rule=\"nonzero\"");
     } else {
-        mOutput << "fill=\"none\" stroke=\"#" << hex << setw(6) << setfill('0') << rgb << dec << "\"" << setfill(' ');
+        write("fill=\"none\" stroke=\""); color(rgb); write('"');
         
-        if (c.a < RGBA8::base_mask) mOutput <<  " stroke-opacity=\"" << c.opacity() << "\"";
-        
-        if (attr.mFlags & AST::CF_ISO_WIDTH) {
-            double scaledWidth = attr.mStrokeWidth * sqrt(fabs(tr.determinant()));
-            mOutput << mEndline << "stroke-width=\"" << scaledWidth << "\"";
-        } else {
-            mOutput << mEndline << "stroke-width=\"" << attr.mStrokeWidth << "\"";
+        if (c.a < RGBA8::base_mask) {
+            write(" stroke-opacity=\""); number(c.opacity()); write('"');
         }
         
-        mOutput << " stroke-linecap=\"";
+        write(mEndline); write("stroke-width=\"");
+        if (attr.mFlags & AST::CF_ISO_WIDTH)
+            number(attr.mStrokeWidth * sqrt(fabs(tr.determinant())));
+        else
+            number(attr.mStrokeWidth);
+        write('"');
+        
+        write(" stroke-linecap=\"");
         switch ((attr.mFlags >> 4) & 15) {
             case agg::square_cap:
-                mOutput << "butt";
+                write("butt");
                 break;
             case agg::round_cap:
-                mOutput << "circle";
+                write("circle");
                 break;
             default:
-                mOutput << "miter";
+                write("miter");
                 break;
         }
         
-        mOutput << "\" stroke-linejoin=\"";
+        write("\" stroke-linejoin=\"");
         switch (attr.mFlags & 15) {
             case agg::bevel_join:
-                mOutput << "bevel";
+                write("bevel");
                 break;
             case agg::round_join:
-                mOutput << "round";
+                write("round");
                 break;
             default:
-                mOutput << "miter";
+                write("miter");
                 break;
         }
         
-        mOutput << "\" stroke-miterlimit=\"" << attr.mMiterLimit << "\"";
+        write("\" stroke-miterlimit=\""); number(attr.mMiterLimit); write('"');
     }
-        
-    if (attr.mFlags & AST::CF_ISO_WIDTH) {
-        mOutput << ' ' << ending;
-    } else {
-        mOutput << mEndline << setprecision(8);
-        mOutput << "transform=\"matrix(" << setw(10) << tr.sx << " " << setw(10) 
-        << tr.shy << " " << setw(10) << tr.shx << " " << setw(10) << tr.sy 
-        << " " << setw(10) << tr.tx << " " << setw(10) << tr.ty << ")\"" 
-        << ending;
+    
+    // Iso-width paths are transformed when they are written out
+    if (!(attr.mFlags & AST::CF_ISO_WIDTH)) {
+        write(mEndline);
+        transform(tr);
     }
+    if (!open)
+        write("/>");
     indent(-padding); 
 }
 
@@ -158,15 +290,16 @@ void SVGCanvas::primitive(int shape, RGBA8 c, agg::trans_affine tr)
     tr *= mOffset;
     static const int padding[3] = { 8, 6, 5 };
     
+    write(mEndline);
     switch (shape) {
         case primShape::circleType:
-            mOutput << mEndline << "<circle r=\"0.5\"";
+            write("<circle r=\"0.5\"");
             break;
         case primShape::squareType:
-            mOutput << mEndline << "<rect x=\"-0.5\" y=\"-0.5\" width=\"1\" height=\"1\" " ;
+            write("<rect x=\"-0.5\" y=\"-0.5\" width=\"1\" height=\"1\"");
             break;
         case primShape::triangleType:
-            mOutput << mEndline << "<use xlink:href=\"#TRIANGLE\"";
+            write("<use xlink:href=\"#TRIANGLE\"");
             break;
             
         default:
@@ -175,67 +308,86 @@ void SVGCanvas::primitive(int shape, RGBA8 c, agg::trans_affine tr)
     complete(c, tr, padding[shape], AST::CommandInfo::Default);
 }
 
+void SVGCanvas::pathData(agg::trans_affine& tr, const AST::CommandInfo& attr)
+{
+    bool iso = (attr.mFlags & AST::CF_ISO_WIDTH) != 0;
+    auto point = [&](double x, double y) {
+        if (iso)
+            tr.transform(&x, &y);
+        number(x);
+        write(',');
+        number(y);
+    };
+    
+    write("d=");
+    attr.mPath->rewind(attr.mIndex);
+    unsigned cmd;
+    char sep = '"';
+    double x, y;
+    while (!agg::is_stop(cmd = attr.mPath->vertex(&x, &y))) {
+        switch (cmd & agg::path_cmd_mask) {
+            case agg::path_cmd_move_to:
+                write(sep); write("M "); point(x, y);
+                break;
+            case agg::path_cmd_line_to:
+                write(sep); write("L "); point(x, y);
+                break;
+            case agg::path_cmd_curve3:
+                write(sep); write("Q "); point(x, y);
+                attr.mPath->vertex(&x, &y);
+                write(' '); point(x, y);
+                break;
+            case agg::path_cmd_curve4:
+                write(sep); write("C "); point(x, y);
+                attr.mPath->vertex(&x, &y);
+                write(' '); point(x, y);
+                attr.mPath->vertex(&x, &y);
+                write(' '); point(x, y);
+                break;
+            case agg::path_cmd_end_poly:
+                if (cmd & agg::path_flags_close) {
+                    write(sep); write('Z');
+                }
+                break;
+            default:
+                break;
+        }
+        sep = ' ';
+    }
+    if (sep == '"') write('"');
+    write("\"/>");
+}
+
 void SVGCanvas::path(RGBA8 c, agg::trans_affine tr, const AST::CommandInfo& attr)
 {
     tr *= mOffset;
-    mOutput << mEndline << "<g ";
-    complete(c, tr, 3, attr, true);
-    indent(2);
+    
+    if (attr.mFlags & AST::CF_ISO_WIDTH) {
+        // The path is transformed but the stroke width is not, so each
+        // instance has its own path data.
+        write(mEndline); write("<path");
+        complete(c, tr, 6, attr, true);
+        indent(6);
+        write(mEndline);
+        pathData(tr, attr);
+        indent(-6);
+        return;
+    }
+    
+    // Each distinct path is defined once and every instance refers to it
     uniquePath attrPath(attr.mPathUID.load(), attr.mIndex);
-    unsigned id = mPathIDMap[attrPath];
-    if (id) {
-        mOutput << mEndline << "<use xlink:href=\"#path" << id << "\" />";
-    } else {
+    unsigned& id = mPathIDMap[attrPath];
+    if (!id) {
         id = mNextPathID++;
-        mPathIDMap[attrPath] = id;
-        mOutput << mEndline << "<path id=\"path" << id << "\" d=";
-        attr.mPath->rewind(attr.mIndex);
-        unsigned cmd;
-        char sep = '"';
-        double x, y;
-        while (!agg::is_stop(cmd = attr.mPath->vertex(&x, &y))) {
-            if (attr.mFlags & AST::CF_ISO_WIDTH) 
-                tr.transform(&x, &y);
-            
-            switch (cmd & agg::path_cmd_mask) {
-                case agg::path_cmd_move_to:
-                    mOutput << sep << "M " << x << ',' << y;
-                    break;
-                case agg::path_cmd_line_to:
-                    mOutput << sep << "L " << x << ',' << y;
-                    break;
-                case agg::path_cmd_curve3:
-                    mOutput << sep << "Q " << x << ',' << y;
-                    attr.mPath->vertex(&x, &y);
-                    if (attr.mFlags & AST::CF_ISO_WIDTH) 
-                        tr.transform(&x, &y);
-                    mOutput << ' ' << x << ',' << y;
-                    break;
-                case agg::path_cmd_curve4:
-                    mOutput << sep << "C " << x << ',' << y;
-                    attr.mPath->vertex(&x, &y);
-                    if (attr.mFlags & AST::CF_ISO_WIDTH) 
-                        tr.transform(&x, &y);
-                    mOutput << ' ' << x << ',' << y;
-                    attr.mPath->vertex(&x, &y);
-                    if (attr.mFlags & AST::CF_ISO_WIDTH) 
-                        tr.transform(&x, &y);
-                    mOutput << ' ' << x << ',' << y;
-                    break;
-                case agg::path_cmd_end_poly:
-                    if (cmd & agg::path_flags_close)
-                        mOutput << sep << 'Z';
-                    break;
-                default:
-                    break;
-            }
-            sep = ' ';
-        }
-        if (sep == '"') mOutput << '"';
-        mOutput << "\"/>";
+        write(mEndline); write("<defs>");
+        indent(2);
+        write(mEndline); write("<path id=\"path"); number(id); write("\" ");
+        pathData(tr, attr);
+        indent(-2);
+        write(mEndline); write("</defs>");
     }
-    indent(-2);
-    mOutput << mEndline << "</g>";
+    write(mEndline); write("<use xlink:href=\"#path"); number(id); write('"');
+    complete(c, tr, 5, attr);
 }
 
 void SVGCanvas::indent(int change)
@@ -257,7 +409,9 @@ SVGCanvas::SVGCanvas(const char* opath, int width, int height, bool crop, const
     mOutputFile(),
     mOutput(*opath ? mOutputFile : cout),
     mDescription(desc),
-    mLength(length)
+    mLength(length),
+    mBuffer(new char[BufferSize]),
+    mBufferUsed(0)
 {
     if (*opath) {
 #ifdef _WIN32
@@ -267,13 +421,37 @@ SVGCanvas::SVGCanvas(const char* opath, int width, int height, bool crop, const
 #else
         mOutputFile.open(opath, ios::binary | ios::trunc | ios::out);
 #endif
+        size_t len = strlen(opath);
+        if (len > 5 && strcmp(opath + len - 5, ".svgz") == 0)
+            mGzip = std::make_unique<gzipStream>();
     }
-    mError = !(mOutputFile.is_open() && mOutputFile.good());
+    mError = *opath ? !(mOutputFile.is_open() && mOutputFile.good()) : !mOutput.good();
     mEndline[0] = '\n';
     mEndline[1] = '\0';
     if (mLength == -1 && mDescription)
         mLength = static_cast<int>(strlen(mDescription));
 }
 
+SVGCanvas::SVGCanvas(std::ostream& out, int width, int height, bool crop, const char* desc, int length,
+                     bool compress)
+:   Canvas(width, height),
+    mPadding(0),
+    mNextPathID(1),
+    mCropped(crop),
+    mOutputFile(),
+    mOutput(out),
+    mDescription(desc),
+    mLength(length),
+    mBuffer(new char[BufferSize]),
+    mBufferUsed(0)
+{
+    if (compress)
+        mGzip = std::make_unique<gzipStream>();
+    mError = !mOutput.good();
+    mEndline[0] = '\n';
+    mEndline[1] = '\0';
+    if (mLength == -1 && mDescription)
+        mLength = static_cast<int>(strlen(mDescription));
+}
 
-
+SVGCanvas::~SVGCanvas() = default;
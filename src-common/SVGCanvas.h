@@ -31,6 +31,8 @@
 #include "cfdg.h"
 #include "ast.h"
 #include <map>
+#include <memory>
+#include <cstring>
 
 class SVGCanvas : public Canvas {
 public:
@@ -39,12 +41,15 @@ public:
 
     void complete(RGBA8 c, agg::trans_affine tr, int padding, 
                   const AST::CommandInfo& attr,
-                  bool g = false);
+                  bool open = false);
     void primitive(int shape, RGBA8 c, agg::trans_affine tr) override;
     void path(RGBA8 c, agg::trans_affine tr, const AST::CommandInfo& attr) override;
 
+    // Output files ending in .svgz are gzip compressed
     SVGCanvas(const char* opath, int width, int height, bool crop, const char* desc = nullptr, int length = -1);
-    ~SVGCanvas() override = default;
+    SVGCanvas(std::ostream& out, int width, int height, bool crop, const char* desc = nullptr, int length = -1,
+              bool compress = false);
+    ~SVGCanvas() override;
 
 private:
     using uniquePath = std::pair<AST::UIDdatatype, unsigned>;
@@ -60,5 +65,33 @@ private:
     const char* mDescription;
     int mLength;
     void indent(int);
+
+    // Output is formatted into a buffer and only handed to the ostream (or
+    // the gzip compressor) when the buffer fills.
+    enum { BufferSize = 65536 };
+    std::unique_ptr<char[]> mBuffer;
+    size_t mBufferUsed;
+    struct gzipStream;
+    std::unique_ptr<gzipStream> mGzip;
+
+    void write(const char* s, size_t n)
+    {
+        if (mBufferUsed + n > BufferSize) flush(false);
+        if (n > BufferSize) { emit(s, n); return; }
+        memcpy(mBuffer.get() + mBufferUsed, s, n);
+        mBufferUsed += n;
+    }
+    void write(const char* s) { write(s, strlen(s)); }
+    void write(char c)
+    {
+        if (mBufferUsed == BufferSize) flush(false);
+        mBuffer[mBufferUsed++] = c;
+    }
+    void number(double v);
+    void color(int rgb);
+    void transform(const agg::trans_affine& tr);
+    void pathData(agg::trans_affine& tr, const AST::CommandInfo& attr);
+    void flush(bool final);
+    void emit(const char* data, size_t n);
 };
 
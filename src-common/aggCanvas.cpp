@@ -45,6 +45,8 @@
 #include "CmdInfo.h"
 #include "pathIterator.h"
 #include <set>
+#include <vector>
+#include <cmath>
 #include <cassert>
 
 #ifdef _WIN32
@@ -167,10 +169,20 @@ class aggCanvas::impl {
         }
         virtual ~impl() = default;
 
+        // Adds a primitive shape to the rasterizer from single precision
+        // geometry, directly in integer subpixel coordinates. Returns false
+        // if the shape is too far out for single precision.
+        bool addFastPrimitive(int shape, const agg::trans_affine& tr, double size);
+        virtual bool fastPrimitives() { return false; }
+
+        std::vector<float> circleTable;     // (cos, sin)/2 pairs for circleSteps
+        unsigned circleSteps = 0;
+
         virtual void reset() = 0;
         virtual void clear(const agg::rgba& bk) = 0;
         virtual void fill(RGBA8 bk) = 0;
         virtual void draw(RGBA8 c, agg::filling_rule_e fr = agg::fill_non_zero) = 0;
+        virtual void blendPixel(int x, int y, RGBA8 c) = 0;
         
         virtual bool colorCount256() = 0;
         
@@ -202,6 +214,7 @@ template <class pixel_fmt> class aggPixelPainter : public aggCanvas::impl {
         void clear(const agg::rgba& bk);
         void fill(RGBA8 bk);
         void draw(RGBA8 c, agg::filling_rule_e fr = agg::fill_non_zero);
+        void blendPixel(int x, int y, RGBA8 c);
 
         bool colorCount256();
         
@@ -209,6 +222,76 @@ template <class pixel_fmt> class aggPixelPainter : public aggCanvas::impl {
                   int stride, aggCanvas::PixelFormat format);
 };
 
+// 8-bit formats can't show the difference between primitives drawn from
+// single and double precision geometry.
+template <class pixel_fmt> class aggFastPainter : public aggPixelPainter<pixel_fmt> {
+    public:
+        static_assert(sizeof(typename pixel_fmt::value_type) == 1,
+                      "Fast primitives are only for 8-bit formats");
+
+        aggFastPainter(aggCanvas* canvas)
+        : aggPixelPainter<pixel_fmt>(canvas) { }
+        ~aggFastPainter() = default;
+
+        bool fastPrimitives() { return true; }
+};
+
+bool
+aggCanvas::impl::addFastPrimitive(int shape, const agg::trans_affine& tr, double size)
+{
+    const double Limit = 1 << 20;   // pixels
+    if (!(std::fabs(tr.tx) < Limit && std::fabs(tr.ty) < Limit &&
+          std::fabs(tr.sx) + std::fabs(tr.shx) < Limit &&
+          std::fabs(tr.shy) + std::fabs(tr.sy) < Limit))
+        return false;
+
+    const double scale = agg::poly_subpixel_scale;
+    const float sx  = static_cast<float>(tr.sx  * scale);
+    const float shy = static_cast<float>(tr.shy * scale);
+    const float shx = static_cast<float>(tr.shx * scale);
+    const float sy  = static_cast<float>(tr.sy  * scale);
+    const int ox = agg::iround(tr.tx * scale);
+    const int oy = agg::iround(tr.ty * scale);
+
+    auto vertex = [&](float x, float y, bool first) {
+        float fx = sx  * x + shx * y;
+        float fy = shy * x + sy  * y;
+        int ix = ox + static_cast<int>(fx < 0.0f ? fx - 0.5f : fx + 0.5f);
+        int iy = oy + static_cast<int>(fy < 0.0f ? fy - 0.5f : fy + 0.5f);
+        if (first)
+            rasterizer.move_to(ix, iy);
+        else
+            rasterizer.line_to(ix, iy);
+    };
+
+    if (shape == primShape::circleType) {
+        // Same vertex count as fast_ellipse
+        unsigned steps = static_cast<unsigned>(size) + 8;
+        steps += (-steps) & 7;
+        if (steps != circleSteps) {
+            circleSteps = steps;
+            circleTable.resize(2 * steps);
+            for (unsigned i = 0; i < steps; ++i) {
+                double angle = (i + 0.5) / steps * 2.0 * M_PI;
+                circleTable[2 * i]     = static_cast<float>(0.5 * std::cos(angle));
+                circleTable[2 * i + 1] = static_cast<float>(0.5 * std::sin(angle));
+            }
+        }
+        for (unsigned i = 0; i < steps; ++i)
+            vertex(circleTable[2 * i], circleTable[2 * i + 1], i == 0);
+    } else {
+        const primShape& unit = primShape::shapeMap[shape];
+        double x, y;
+        for (unsigned i = 0; i < unit.total_vertices(); ++i) {
+            unsigned cmd = unit.vertex(i, &x, &y);
+            if (agg::is_vertex(cmd))
+                vertex(static_cast<float>(x), static_cast<float>(y), agg::is_move_to(cmd));
+        }
+    }
+    rasterizer.close_polygon();
+    return true;
+}
+
 template <class pixel_fmt>
 bool
 aggPixelPainter<pixel_fmt>::colorCount256()
@@ -258,6 +341,25 @@ aggPixelPainter<pixel_fmt>::draw(RGBA8 col, agg::filling_rule_e fr)
     rasterizer.reset();
 }
 
+template <class pixel_fmt>
+void
+aggPixelPainter<pixel_fmt>::blendPixel(int x, int y, RGBA8 col)
+{
+    using color_type = typename pixel_fmt::color_type;
+    using Converter_type = agg::ColorConverter<RGBA8, color_type>;
+    if (pixelSet.size() < PNG8Limit) {
+        agg::int64u pixel = 
+            static_cast<agg::int64u>(col.r) << 48 |
+            static_cast<agg::int64u>(col.g) << 32 |
+            static_cast<agg::int64u>(col.b) << 16 |
+            static_cast<agg::int64u>(col.a);
+        pixelSet.insert(pixel);
+    }
+    
+    color_type c = Converter_type::f(col);
+    rendBase.blend_pixel(x, y, c.premultiply(), agg::cover_full);
+}
+
 template <class  pixel_fmt>
 void
 aggPixelPainter<pixel_fmt>::copy(void* data, unsigned width, unsigned height,
@@ -317,15 +419,15 @@ aggPixelPainter<pixel_fmt>::copy(void* data, unsigned width, unsigned height,
 
 aggCanvas::aggCanvas(PixelFormat pixfmt) : Canvas(0, 0) { 
     switch (pixfmt) {
-        case Gray8_Blend:   m = std::make_unique<aggPixelPainter<gray_pixel_fmt>>(this); break;
-        case RGBA8_Blend:   m = std::make_unique<aggPixelPainter<color32_pixel_fmt>>(this); break;
-        case RGB8_Blend:    m = std::make_unique<aggPixelPainter<color24_pixel_fmt>>(this); break;
+        case Gray8_Blend:   m = std::make_unique<aggFastPainter<gray_pixel_fmt>>(this); break;
+        case RGBA8_Blend:   m = std::make_unique<aggFastPainter<color32_pixel_fmt>>(this); break;
+        case RGB8_Blend:    m = std::make_unique<aggFastPainter<color24_pixel_fmt>>(this); break;
         case Gray16_Blend:  m = std::make_unique<aggPixelPainter<gray16_pixel_fmt>>(this); break;
         case RGBA16_Blend:  m = std::make_unique<aggPixelPainter<color64_pixel_fmt>>(this); break;
         case RGB16_Blend:   m = std::make_unique<aggPixelPainter<color48_pixel_fmt>>(this); break;
-        case FF_Blend:      m = std::make_unique<aggPixelPainter<ff_pixel_fmt>>(this); break;
-        case FF24_Blend:    m = std::make_unique<aggPixelPainter<ff24_pixel_fmt>>(this); break;
-        case AV_Blend:      m = std::make_unique<aggPixelPainter<av_pixel_fmt>>(this); break;
+        case FF_Blend:      m = std::make_unique<aggFastPainter<ff_pixel_fmt>>(this); break;
+        case FF24_Blend:    m = std::make_unique<aggFastPainter<ff24_pixel_fmt>>(this); break;
+        case AV_Blend:      m = std::make_unique<aggFastPainter<av_pixel_fmt>>(this); break;
         default: break;
     }
 }
@@ -358,6 +460,13 @@ aggCanvas::primitive(int shape, RGBA8 c, agg::trans_affine tr)
     double size = adjustShapeSize(tr, shape) / 2.0;
     tr *= m->offset;
     
+    if (shape >= 0 && shape < primShape::fillType && mFastPrimitives && m->fastPrimitives() &&
+        m->addFastPrimitive(shape, tr, size))
+    {
+        m->draw(c);
+        return;
+    }
+    
     switch (shape) {
         case primShape::circleType:
             m->shapeEllipse.transformer(tr);
@@ -383,6 +492,12 @@ aggCanvas::primitive(int shape, RGBA8 c, agg::trans_affine tr)
     m->draw(c);
 }
 
+void
+aggCanvas::pixel(int x, int y, RGBA8 c)
+{
+    m->blendPixel(x + m->offsetX, y + m->offsetY, c);
+}
+
 void
 aggCanvas::path(RGBA8 c, agg::trans_affine tr, const AST::CommandInfo& attr)
 {
@@ -391,6 +506,7 @@ aggCanvas::path(RGBA8 c, agg::trans_affine tr, const AST::CommandInfo& attr)
     agg::filling_rule_e rule =  (attr.mFlags & (AST::CF_EVEN_ODD | AST::CF_FILL)) == (AST::CF_EVEN_ODD | AST::CF_FILL) ?
         agg::fill_even_odd : agg::fill_non_zero;
     
+    m->pathSource.mReuseStrokes = mReuseStrokes;
     m->pathSource.addPath(m->rasterizer, tr, attr);
     m->draw(c, rule);
 }
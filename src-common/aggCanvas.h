@@ -56,6 +56,7 @@ class aggCanvas : public Canvas {
 
         void primitive(int shape, RGBA8 c, agg::trans_affine tr) override;
         void path(RGBA8 c, agg::trans_affine tr, const AST::CommandInfo& attr) override;
+        void pixel(int x, int y, RGBA8 c) override;
         
         bool colorCount256();
             // return whether the aggCanvas can fit in byte pixels
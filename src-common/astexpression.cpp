@@ -25,10 +25,13 @@
 
 #include "astexpression.h"
 #include "builder.h"
+#include "cfdgimpl.h"
 #include "rendererAST.h"
 
 #include <math.h>
+#include <cmath>
 #include <cassert>
+#include <typeinfo>
 
 namespace AST {
     
@@ -338,13 +341,15 @@ namespace AST {
 
     ASTmodification::ASTmodification(const ASTmodification& m, const yy::location& loc)
     : ASTexpression(loc, true, false, ModType), modData(m.modData), 
-      modClass(m.modClass), entropyIndex(m.entropyIndex), canonical(m.canonical)
+      modClass(m.modClass), identityClass(m.identityClass),
+      entropyIndex(m.entropyIndex), canonical(m.canonical)
     {
         assert(m.modExp.empty());
     }
     
     ASTmodification::ASTmodification(mod_ptr m, const yy::location& loc)
-    : ASTexpression(loc, true, false, ModType), entropyIndex(0), canonical(true)
+    : ASTexpression(loc, true, false, ModType), identityClass(NotAClass),
+      entropyIndex(0), canonical(true)
     {
         if (m) {
             modData.mRand64Seed.seed(0);
@@ -362,6 +367,7 @@ namespace AST {
         modData.mRand64Seed ^= oldEntropy;
         modExp.swap(m->modExp);
         modClass = m->modClass;
+        identityClass = NotAClass;
         entropyIndex = (entropyIndex + m->entropyIndex) & 7;
         isConstant = modExp.empty();
         canonical = m->canonical;
@@ -381,7 +387,7 @@ namespace AST {
     
     ASTvariable::ASTvariable(int stringNum, const std::string& str, const yy::location& loc)
     : ASTexpression(loc), stringIndex(stringNum), text(str), stackIndex(0),
-      isParameter(false) { };
+      localIndex(-1), isParameter(false) { };
     
     ASTuserFunction::ASTuserFunction(int name, ASTexpression* args, ASTdefine* func,
                                      const yy::location& nameLoc)
@@ -403,7 +409,7 @@ namespace AST {
                        const yy::location& loc, const std::string& name)
     : ASTexpression(loc, false, false, NumericType), mName(nameIndex),
       mArgs(std::move(args)), mLength(1), mStride(1),
-      mStackIndex(-1), mCount(0), isParameter(false), entString(name)
+      mStackIndex(-1), mLocalIndex(-1), mCount(0), isParameter(false), entString(name)
     {
     }
 
@@ -1262,7 +1268,7 @@ namespace AST {
     ASTmodification::evaluate(Modification& m, bool shapeDest, RendererAST* rti) const
     {
         if (shapeDest) {
-            m *= modData;
+            applyTo(m);
         } else {
             if (m.merge(modData))
                 RendererAST::ColorConflict(rti, where);
@@ -1272,6 +1278,22 @@ namespace AST {
             term->evaluate(m, shapeDest, rti);
     }
     
+    void
+    ASTmodification::applyTo(Modification& m) const
+    {
+        // Same as m *= modData, but skips the parts of modData that
+        // simplify() found to be the identity
+        simdAffine::premultiply(m.m_transform, modData.m_transform);
+        if (!(identityClass & ZClass))
+            m.m_Z.premultiply(modData.m_Z);
+        if (!(identityClass & TimeClass))
+            m.m_time.premultiply(modData.m_time);
+        if ((identityClass & ColorClasses) != ColorClasses)
+            HSBColor::Adjust(m.m_Color, m.m_ColorTarget, modData.m_Color,
+                             modData.m_ColorTarget, modData.m_ColorAssignment);
+        m.mRand64Seed ^= modData.mRand64Seed;
+    }
+    
     void
     ASTmodification::setVal(Modification& m, RendererAST* rti) const
     {
@@ -1359,12 +1381,12 @@ namespace AST {
                 if (argcount == 1)
                     modArgs[1] = 0.0;
                 agg::trans_affine_translation trx(modArgs[0], modArgs[1]);
-                m.m_transform.premultiply(trx);
+                simdAffine::premultiply(m.m_transform, trx);
                 break;
             }
             case ASTmodTerm::y: {
                 agg::trans_affine_translation tr(0.0, modArgs[0]);
-                m.m_transform.premultiply(tr);
+                simdAffine::premultiply(m.m_transform, tr);
                 break;
             }
             case ASTmodTerm::z: {
@@ -1374,7 +1396,7 @@ namespace AST {
             }
             case ASTmodTerm::xyz: {
                 agg::trans_affine_translation trx(modArgs[0], modArgs[1]);
-                m.m_transform.premultiply(trx);
+                simdAffine::premultiply(m.m_transform, trx);
                 agg::trans_affine_1D_translation trz(modArgs[2]);
                 m.m_Z.premultiply(trz);
                 break;
@@ -1396,7 +1418,7 @@ namespace AST {
                         if (argcount == 1) 
                             modArgs[1] = 0.0;
                         agg::trans_affine_translation trx(modArgs[0], modArgs[1]);
-                        m.m_transform.premultiply(trx);
+                        simdAffine::premultiply(m.m_transform, trx);
                         break;
                     }
                     case 4: {
@@ -1406,13 +1428,13 @@ namespace AST {
                         sq.scale(sqrt(dx * dx + dy * dy));
                         sq.rotate(atan2(dy, dx));
                         sq.translate(modArgs[0], modArgs[1]);
-                        m.m_transform.premultiply(sq);
+                        simdAffine::premultiply(m.m_transform, sq);
                         break;
                     }
                     case 6: {
                         agg::trans_affine par;
                         par.rect_to_parl(0.0, 0.0, 1.0, 1.0, modArgs);
-                        m.m_transform.premultiply(par);
+                        simdAffine::premultiply(m.m_transform, par);
                         break;
                     }
                     default:
@@ -1424,12 +1446,12 @@ namespace AST {
                 if (argcount == 1)
                     modArgs[1] = modArgs[0];
                 agg::trans_affine_scaling sc(modArgs[0], modArgs[1]);
-                m.m_transform.premultiply(sc);
+                simdAffine::premultiply(m.m_transform, sc);
                 break;
             }
             case ASTmodTerm::sizexyz: {
                 agg::trans_affine_scaling sc(modArgs[0], modArgs[1]);
-                m.m_transform.premultiply(sc);
+                simdAffine::premultiply(m.m_transform, sc);
                 agg::trans_affine_1D_scaling scz(modArgs[2]);
                 m.m_Z.premultiply(scz);
                 break;
@@ -1441,18 +1463,18 @@ namespace AST {
             }
             case ASTmodTerm::rot: {
                 agg::trans_affine_rotation rot(modArgs[0] * MY_PI / 180.0);
-                m.m_transform.premultiply(rot);
+                simdAffine::premultiply(m.m_transform, rot);
                 break;
             }
             case ASTmodTerm::skew: {
                 agg::trans_affine_skewing sk(modArgs[0] * MY_PI / 180.0,
                                              modArgs[1] * MY_PI / 180.0);
-                m.m_transform.premultiply(sk);
+                simdAffine::premultiply(m.m_transform, sk);
                 break;
             }
             case ASTmodTerm::flip: {
                 agg::trans_affine_reflection ref(modArgs[0] * MY_PI / 180.0);
-                m.m_transform.premultiply(ref);
+                simdAffine::premultiply(m.m_transform, ref);
                 break;
             }
             case ASTmodTerm::alpha:
@@ -1948,6 +1970,55 @@ namespace AST {
             return MakeResult(result, tupleSize, this);
         }
         
+        if (mType != NumericType)
+            return nullptr;
+        
+        // Fold away constant operands that leave the other operand unchanged.
+        // The remaining operand is evaluated exactly as before, so it consumes
+        // the same random numbers.
+        auto isValue = [](const exp_ptr& e, double v) {
+            const ASTreal* r = dynamic_cast<const ASTreal*>(e.get());
+            return r && r->value == v && !std::signbit(r->value);
+        };
+        auto unchanged = [this](exp_ptr& e) -> ASTexpression* {
+            if (e->mType != NumericType || e->isNatural != isNatural ||
+                e->evaluate() != tupleSize)
+                return nullptr;
+            return e.release();
+        };
+        switch (op) {
+            case 'P':
+                return unchanged(left);
+            case '*':
+                if (isValue(right, 1.0))
+                    return unchanged(left);
+                if (isValue(left, 1.0))
+                    return unchanged(right);
+                break;
+            case '/':
+                if (isValue(right, 1.0))
+                    return unchanged(left);
+                break;
+            case '-':
+                if (right && isValue(right, 0.0))
+                    return unchanged(left);
+                break;
+            case '&':
+            case '|': {
+                const ASTreal* l = dynamic_cast<const ASTreal*>(left.get());
+                if (!l || !right || right->evaluate() != 1)
+                    break;
+                // right is not evaluated if left decides the result
+                if ((l->value == 0.0) == (op == '&')) {
+                    double result = op == '&' ? 0.0 : l->value;
+                    return MakeResult(&result, 1, this);
+                }
+                return unchanged(right);
+            }
+            default:
+                break;
+        }
+        
         return nullptr;
     }
     
@@ -2043,6 +2114,26 @@ namespace AST {
                 modExp.push_back(std::move(mod));
             }
         }
+        
+        // Constant terms are now composed into modData. Note the parts of
+        // modData that would not change a shape so that applyTo() can skip
+        // them.
+        static const agg::trans_affine_1D IdentityZ;
+        static const agg::trans_affine_time IdentityTime;
+        auto isZero = [](const HSBColor& c) {
+            return c.h == 0.0 && c.s == 0.0 && c.b == 0.0 && c.a == 0.0;
+        };
+        identityClass = NotAClass;
+        if (modData.m_Z.sz == IdentityZ.sz && modData.m_Z.tz == IdentityZ.tz)
+            identityClass |= ZClass;
+        if (modData.m_time.st == IdentityTime.st &&
+            modData.m_time.tbegin == IdentityTime.tbegin &&
+            modData.m_time.tend == IdentityTime.tend)
+        {
+            identityClass |= TimeClass;
+        }
+        if (isZero(modData.m_Color) && isZero(modData.m_ColorTarget))
+            identityClass |= ColorClasses;
         return nullptr;
     }
     
@@ -2477,6 +2568,7 @@ namespace AST {
                         if (arguments && arguments->mType != AST::NoType) {
                             if (arguments->isConstant) {
                                 simpleRule = evalArgs();
+                                Builder::CurrentBuilder->m_CFDG->addPermanentParams(simpleRule.get());
                                 argSource = SimpleArgs;
                                 isConstant = true;
                                 mLocality = PureLocal;
@@ -2488,6 +2580,7 @@ namespace AST {
                         } else {
                             argSource = NoArgs;
                             simpleRule = StackRule::alloc(shapeType, 0, typeSignature);
+                            Builder::CurrentBuilder->m_CFDG->addPermanentParams(simpleRule.get());
                             isConstant = true;
                             mLocality = PureLocal;
                         }
@@ -2567,6 +2660,7 @@ namespace AST {
                     
                     count = bound->mType == AST::NumericType ? bound->mTuplesize : 1;
                     stackIndex = bound->mStackIndex - (isGlobal ? 0 : Builder::CurrentBuilder->mLocalStackDepth);
+                    localIndex = isGlobal ? -1 : bound->mStackIndex;
                     mType = bound->mType;
                     isNatural = bound->isNatural;
                     mLocality = bound->mLocality;
@@ -3030,6 +3124,7 @@ namespace AST {
                 isNatural = bound->isNatural;
                 mStackIndex = bound->mStackIndex -
                     (isGlobal ? 0 : Builder::CurrentBuilder->mLocalStackDepth);
+                mLocalIndex = isGlobal ? -1 : bound->mStackIndex;
                 mCount = bound->mTuplesize;
                 isParameter = bound->isParameter;
                 mLocality = bound->mLocality;
@@ -3105,5 +3200,207 @@ namespace AST {
             return arguments.size() - 1;
         return i;
     }
-}
 
+    ASThoisted::ASThoisted(exp_ptr e, int slot, int bit, int count)
+    : ASTexpression(e->where, false, e->isNatural, e->mType),
+      mExpression(std::move(e)), mSlot(slot), mBit(bit), mCount(count)
+    {
+        mLocality = mExpression->mLocality;
+    }
+    
+    int
+    ASThoisted::evaluate(double* res, int length, RendererAST* rti) const
+    {
+        if (!res)
+            return mCount;
+        if (length < mCount)
+            return -1;
+        if (rti == nullptr) throw DeferUntilRuntime();
+        
+        HoistedValues* hoisted = rti->mHoisted;
+        assert(hoisted);
+        double* values = hoisted->mValues + mSlot;
+        std::uint64_t bit = static_cast<std::uint64_t>(1) << mBit;
+        if (!(hoisted->mReady & bit)) {
+            int num = mExpression->evaluate(values, mCount, rti);
+            if (num != mCount)
+                return num;
+            hoisted->mReady |= bit;
+        }
+        for (int i = 0; i < mCount; ++i)
+            res[i] = values[i];
+        return mCount;
+    }
+    
+    void
+    ASThoisted::entropy(std::string& e) const
+    {
+        mExpression->entropy(e);
+    }
+    
+    void
+    ASThoister::hoist(exp_ptr& e)
+    {
+        if (!e || e->isConstant)
+            return;
+        
+        if (e->mType == NumericType && isInvariant(e.get()) &&
+            (dynamic_cast<const ASToperator*>(e.get()) ||
+             dynamic_cast<const ASTfunction*>(e.get()) ||
+             dynamic_cast<const ASTselect*>(e.get()) ||
+             dynamic_cast<const ASTarray*>(e.get())))
+        {
+            for (const ASThoisted* h: mHoisted) {
+                if (isSame(h->mExpression.get(), e.get())) {
+                    e = std::make_unique<ASThoisted>(std::move(e), h->mSlot, h->mBit, h->mCount);
+                    mHoisted.push_back(static_cast<const ASThoisted*>(e.get()));
+                    return;
+                }
+            }
+            int count = e->evaluate();
+            if (count > 0 && mValueCount + count <= HoistedValues::MaxValues &&
+                mBitCount < HoistedValues::MaxValues)
+            {
+                e = std::make_unique<ASThoisted>(std::move(e), mValueCount, mBitCount++, count);
+                mValueCount += count;
+                mHoisted.push_back(static_cast<const ASThoisted*>(e.get()));
+                return;
+            }
+        }
+        
+        if (ASToperator* o = dynamic_cast<ASToperator*>(e.get())) {
+            hoist(o->left);
+            hoist(o->right);
+        } else if (ASTfunction* f = dynamic_cast<ASTfunction*>(e.get())) {
+            hoist(f->arguments);
+        } else if (ASTcons* c = dynamic_cast<ASTcons*>(e.get())) {
+            for (exp_ptr& child: c->children)
+                hoist(child);
+        } else if (ASTselect* sel = dynamic_cast<ASTselect*>(e.get())) {
+            hoist(sel->selector);
+            for (exp_ptr& arg: sel->arguments)
+                hoist(arg);
+        } else if (ASTparen* p = dynamic_cast<ASTparen*>(e.get())) {
+            hoist(p->e);
+        } else if (ASTarray* a = dynamic_cast<ASTarray*>(e.get())) {
+            hoist(a->mArgs);
+        } else if (ASTmodification* m = dynamic_cast<ASTmodification*>(e.get())) {
+            hoist(*m);
+        }
+    }
+    
+    void
+    ASThoister::hoist(ASTmodification& m)
+    {
+        for (term_ptr& term: m.modExp)
+            hoist(term->args);
+    }
+    
+    bool
+    ASThoister::isInvariant(const ASTexpression* e) const
+    {
+        if (!e || e->isConstant)
+            return true;
+        
+        if (const ASTvariable* v = dynamic_cast<const ASTvariable*>(e))
+            return v->mType == NumericType &&
+                   (v->localIndex < 0 || v->localIndex + v->count <= mLoopIndex);
+        if (const ASToperator* o = dynamic_cast<const ASToperator*>(e))
+            return isInvariant(o->left.get()) && isInvariant(o->right.get());
+        if (const ASTfunction* f = dynamic_cast<const ASTfunction*>(e))
+            return (f->functype < ASTfunction::Rand ||
+                    f->functype > ASTfunction::RandGeometric) &&
+                   isInvariant(f->arguments.get());
+        if (const ASTcons* c = dynamic_cast<const ASTcons*>(e)) {
+            for (const exp_ptr& child: c->children)
+                if (!isInvariant(child.get()))
+                    return false;
+            return true;
+        }
+        if (const ASTselect* sel = dynamic_cast<const ASTselect*>(e)) {
+            for (const exp_ptr& arg: sel->arguments)
+                if (!isInvariant(arg.get()))
+                    return false;
+            return isInvariant(sel->selector.get());
+        }
+        if (const ASTparen* p = dynamic_cast<const ASTparen*>(e))
+            return isInvariant(p->e.get());
+        if (const ASTarray* a = dynamic_cast<const ASTarray*>(e))
+            return (a->mData || a->mLocalIndex < 0 ||
+                    a->mLocalIndex + a->mCount <= mLoopIndex) &&
+                   isInvariant(a->mArgs.get());
+        
+        // User functions can call the random functions
+        return false;
+    }
+    
+    bool
+    ASThoister::isSame(const ASTexpression* a, const ASTexpression* b)
+    {
+        if (!a || !b)
+            return a == b;
+        if (typeid(*a) != typeid(*b) || a->mType != b->mType ||
+            a->isNatural != b->isNatural)
+        {
+            return false;
+        }
+        
+        if (const ASTreal* ra = dynamic_cast<const ASTreal*>(a)) {
+            const ASTreal* rb = static_cast<const ASTreal*>(b);
+            return ra->value == rb->value &&
+                   std::signbit(ra->value) == std::signbit(rb->value);
+        }
+        if (const ASTvariable* va = dynamic_cast<const ASTvariable*>(a)) {
+            // The same stack index relative to the same local stack position
+            // means that both are evaluated at the same stack depth
+            const ASTvariable* vb = static_cast<const ASTvariable*>(b);
+            return va->stackIndex == vb->stackIndex &&
+                   va->localIndex == vb->localIndex && va->count == vb->count;
+        }
+        if (const ASToperator* oa = dynamic_cast<const ASToperator*>(a)) {
+            const ASToperator* ob = static_cast<const ASToperator*>(b);
+            return oa->op == ob->op && oa->tupleSize == ob->tupleSize &&
+                   isSame(oa->left.get(), ob->left.get()) &&
+                   isSame(oa->right.get(), ob->right.get());
+        }
+        if (const ASTfunction* fa = dynamic_cast<const ASTfunction*>(a)) {
+            const ASTfunction* fb = static_cast<const ASTfunction*>(b);
+            return fa->functype == fb->functype && fa->random == fb->random &&
+                   isSame(fa->arguments.get(), fb->arguments.get());
+        }
+        if (const ASTcons* ca = dynamic_cast<const ASTcons*>(a)) {
+            const ASTcons* cb = static_cast<const ASTcons*>(b);
+            if (ca->children.size() != cb->children.size())
+                return false;
+            for (size_t i = 0; i < ca->children.size(); ++i)
+                if (!isSame(ca->children[i].get(), cb->children[i].get()))
+                    return false;
+            return true;
+        }
+        if (const ASTselect* sa = dynamic_cast<const ASTselect*>(a)) {
+            const ASTselect* sb = static_cast<const ASTselect*>(b);
+            if (sa->ifSelect != sb->ifSelect || sa->tupleSize != sb->tupleSize ||
+                sa->arguments.size() != sb->arguments.size() ||
+                !isSame(sa->selector.get(), sb->selector.get()))
+            {
+                return false;
+            }
+            for (size_t i = 0; i < sa->arguments.size(); ++i)
+                if (!isSame(sa->arguments[i].get(), sb->arguments[i].get()))
+                    return false;
+            return true;
+        }
+        if (const ASTparen* pa = dynamic_cast<const ASTparen*>(a))
+            return isSame(pa->e.get(), static_cast<const ASTparen*>(b)->e.get());
+        if (const ASTarray* aa = dynamic_cast<const ASTarray*>(a)) {
+            const ASTarray* ab = static_cast<const ASTarray*>(b);
+            return !aa->mData && !ab->mData &&
+                   aa->mStackIndex == ab->mStackIndex &&
+                   aa->mLocalIndex == ab->mLocalIndex &&
+                   aa->mLength == ab->mLength && aa->mStride == ab->mStride &&
+                   aa->mCount == ab->mCount &&
+                   isSame(aa->mArgs.get(), ab->mArgs.get());
+        }
+        return false;
+    }
+}
@@ -35,6 +35,8 @@
 #include "Rand64.h"
 #include <map>
 #include <initializer_list>
+#include <vector>
+#include <cstdint>
 
 class RendererAST;
 class Builder;
@@ -236,6 +238,7 @@ namespace AST {
         int stringIndex;
         std::string text;
         int stackIndex;
+        int localIndex;         // position in the local stack frame, -1 if global
         int count;
         bool isParameter;
         
@@ -347,15 +350,21 @@ namespace AST {
             HueTargetClass = 128, SatTargetClass = 256, BrightTargetClass = 512, AlphaTargetClass = 1024,
             StrokeClass = 2048, ParamClass = 4096, PathOpClass = 8192
         };
+        enum consts_e {
+            ColorClasses = HueClass | SatClass | BrightClass | AlphaClass |
+                           HueTargetClass | SatTargetClass | BrightTargetClass |
+                           AlphaTargetClass
+        };
         Modification    modData;
         ASTtermArray    modExp;
         int             modClass;
+        int             identityClass;  // parts of modData that change nothing
         int             entropyIndex;
         bool            canonical;
         
         ASTmodification(const yy::location& loc)
         : ASTexpression(loc, true, false, ModType), modClass(NotAClass),
-          entropyIndex(0), canonical(true) {}
+          identityClass(NotAClass), entropyIndex(0), canonical(true) {}
         ASTmodification(const ASTmodification& m, const yy::location& loc);
         ASTmodification(mod_ptr m, const yy::location& loc);
         ~ASTmodification() override;
@@ -364,6 +373,7 @@ namespace AST {
         ASTexpression* simplify() override;
         ASTexpression* compile(CompilePhase ph) override;
         void setVal(Modification& m, RendererAST* = nullptr) const;
+        void applyTo(Modification& m) const;
         void addEntropy(const std::string& name);
         void makeCanonical();
         void grab(ASTmodification* m);
@@ -376,6 +386,7 @@ namespace AST {
         int     mLength;
         int     mStride;
         int     mStackIndex;
+        int     mLocalIndex;    // position in the local stack frame, -1 if global
         int     mCount;
         bool    isParameter;
         std::string entString;
@@ -390,6 +401,47 @@ namespace AST {
         ASTexpression* compile(CompilePhase ph) override;
     };
     
+    // Values of the ASThoisted expressions of the innermost loop that is
+    // being traversed. Each value is computed the first time it is used in a
+    // traversal of the loop and reused for the remaining iterations.
+    struct HoistedValues {
+        enum consts_e { MaxValues = 64 };
+        double          mValues[MaxValues];
+        std::uint64_t   mReady = 0;         // one bit per hoisted expression
+    };
+    class ASThoisted : public ASTexpression {
+    public:
+        exp_ptr mExpression;
+        int     mSlot;          // index of the first value in HoistedValues
+        int     mBit;           // ready bit in HoistedValues
+        int     mCount;
+        
+        ASThoisted(exp_ptr e, int slot, int bit, int count);
+        ~ASThoisted() override = default;
+        int evaluate(double* dest = nullptr, int size = 0, RendererAST* rti = nullptr) const override;
+        void entropy(std::string& e) const override;
+    };
+    // Replaces loop-invariant numeric subexpressions in a loop body with
+    // ASThoisted expressions. An expression is invariant if it only reads
+    // variables that are below the loop index on the stack and does not call
+    // the random functions, so the random number stream is consumed exactly
+    // as before. Identical invariant expressions share a value.
+    class ASThoister {
+    public:
+        explicit ASThoister(int loopIndex) : mLoopIndex(loopIndex) {}
+        void hoist(exp_ptr& e);
+        void hoist(ASTmodification& m);
+        int count() const { return mBitCount; }
+    private:
+        int mLoopIndex;         // local stack position of the loop index
+        int mValueCount = 0;
+        int mBitCount = 0;
+        std::vector<const ASThoisted*> mHoisted;
+        
+        bool isInvariant(const ASTexpression* e) const;
+        static bool isSame(const ASTexpression* a, const ASTexpression* b);
+    };
+    
     inline void Compile(exp_ptr& exp, CompilePhase ph)
     {
         if (!exp) return;
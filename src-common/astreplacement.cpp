@@ -130,7 +130,8 @@ namespace AST {
                      exp_ptr args, const yy::location& argsLoc,  
                      mod_ptr mods)
     : ASTreplacement(std::move(mods), nameLoc + argsLoc, empty), mLoopArgs(std::move(args)),
-      mLoopModHolder(nullptr), mLoopIndexName(nameIndex), mLoopName(name)
+      mLoopModHolder(nullptr), mLoopIndexName(nameIndex), mLoopName(name),
+      mHoistedCount(0), mBatchBody(nullptr)
     {
         mLoopBody.addLoopParameter(mLoopIndexName, false, false, mLocation);
         mFinallyBody.addLoopParameter(mLoopIndexName, false, false, mLocation);
@@ -196,7 +197,7 @@ namespace AST {
     }
 
     ASTrule::ASTrule(int i)
-    : ASTreplacement(nullptr, CfdgError::Default, rule), mCachedPath(nullptr),
+    : ASTreplacement(nullptr, CfdgError::Default, rule),
       mWeight(1.0), isPath(true), mNameIndex(i), weightType(NoWeight)
     {
         if (primShape::shapeMap[i].total_vertices() > 0) {
@@ -362,6 +363,7 @@ namespace AST {
             end = mLoopData[1];
             step = mLoopData[2];
         }
+        const Rand64 loopSeed = r->mCurrentSeed;
         const StackType* oldTop = r->mLogicalStackTop;
         if (r->mStackSize + 1 > r->mCFstack.size())
             CfdgError::Error(mLocation, "Maximum stack depth exceeded");
@@ -369,6 +371,55 @@ namespace AST {
         index.number = start;
         ++r->mStackSize;
         r->mLogicalStackTop = &index + 1;
+        HoistedValues hoisted;
+        {
+            // The outer loop's hoisted values are back in place for the
+            // finally body, or if the loop body throws
+            struct HoistedScope {
+                HoistedValues*& mCurrent;
+                HoistedValues* mOld;
+                ~HoistedScope() { mCurrent = mOld; }
+            } hoistedScope{r->mHoisted, r->mHoisted};
+            if (mHoistedCount)
+                r->mHoisted = &hoisted;
+            if (mBatchBody) {
+                traverseShape(loopChild, index, end, step, r);
+            } else {
+                Rand64::result_type iteration = 0;
+                for (;;) {
+                    if (r->requestStop || Renderer::AbortEverything)
+                        throw CfdgError(mLocation, "Stopping");
+                
+                    if (step > 0.0) {
+                        if (index.number >= end)
+                            break;
+                    } else {
+                        if (index.number <= end)
+                            break;
+                    }
+                    if (r->mSplitSeeds)
+                        r->mCurrentSeed = loopSeed.split(iteration++);
+                    mLoopBody.traverse(loopChild, tr || opsOnly, r);
+                    mChildChange.evaluate(loopChild.mWorldState, true, r);
+                    index.number += step;
+                }
+            }
+        }
+        if (r->mSplitSeeds)
+            r->mCurrentSeed = loopSeed;
+        mFinallyBody.traverse(loopChild, tr || opsOnly, r);
+        --r->mStackSize;
+        r->mLogicalStackTop = oldTop;
+    }
+    
+    void
+    ASTloop::traverseShape(Shape& loopChild, StackType& index,
+                           double end, double step, RendererAST* r) const
+    {
+        // Same as the general loop with ASTrepContainer::traverse() and
+        // ASTreplacement::traverse() inlined.
+        const Rand64 loopSeed = r->mCurrentSeed;
+        Rand64::result_type iteration = 0;
         for (;;) {
             if (r->requestStop || Renderer::AbortEverything)
                 throw CfdgError(mLocation, "Stopping");
@@ -380,13 +431,18 @@ namespace AST {
                 if (index.number <= end)
                     break;
             }
-            mLoopBody.traverse(loopChild, tr || opsOnly, r);
+            if (r->mSplitSeeds)
+                r->mCurrentSeed = loopSeed.split(iteration++).split(0);
+            size_t s = r->mStackSize;
+            Shape child(loopChild);
+            mBatchBody->replace(child, r);
+            child.mWorldState.mRand64Seed = r->mCurrentSeed;
+            child.mWorldState.mRand64Seed();
+            r->processShape(child);
+            r->unwindStack(s, mLoopBody.mParameters);
             mChildChange.evaluate(loopChild.mWorldState, true, r);
             index.number += step;
         }
-        mFinallyBody.traverse(loopChild, tr || opsOnly, r);
-        --r->mStackSize;
-        r->mLogicalStackTop = oldTop;
     }
     
     void
@@ -409,14 +465,19 @@ namespace AST {
             if (i < modsLength) {
                 mods[i]->evaluate(child.mWorldState, true, r);
             } else {
-                child.mWorldState.m_transform.premultiply(transforms[i - modsLength]);
+                simdAffine::premultiply(child.mWorldState.m_transform, transforms[i - modsLength]);
             }
-            r->mCurrentSeed();
+            if (!r->mSplitSeeds)
+                r->mCurrentSeed();
 
             // Specialized mBody.traverse() with cloning behavior
             size_t s = r->mStackSize;
+            const Rand64 bodySeed = mClone ? cloneSeed : cloneSeed.split(i);
+            Rand64::result_type index = 0;
             for (const rep_ptr& rep: mBody.mBody) {
-                if (mClone)
+                if (r->mSplitSeeds)
+                    r->mCurrentSeed = bodySeed.split(index++);
+                else if (mClone)
                     r->mCurrentSeed = cloneSeed;
                 rep->traverse(child, opsOnly || tr, r);
             }
@@ -561,10 +622,11 @@ namespace AST {
         r->mRandUsed = false;
         
         cpath_ptr savedPath;
+        cpath_ptr& cachedPath = r->mCachedPaths[this];
         
-        if (mCachedPath && StackRule::Equal(mCachedPath->mParameters.get(), parent.mParameters.get())) {
+        if (cachedPath && StackRule::Equal(cachedPath->mParameters.get(), parent.mParameters.get())) {
             savedPath = std::move(r->mCurrentPath);
-            r->mCurrentPath = std::move(mCachedPath);
+            r->mCurrentPath = std::move(cachedPath);
             r->mCurrentCommand = r->mCurrentPath->mCommandInfo.begin();
         } else {
             r->mCurrentPath->mTerminalCommand.mLocation = mLocation;
@@ -577,13 +639,15 @@ namespace AST {
             r->mCurrentPath->mTerminalCommand.traverse(parent, false, r);
         
         if (savedPath) {
-            mCachedPath = std::move(r->mCurrentPath);
+            cachedPath = std::move(r->mCurrentPath);
             r->mCurrentPath = std::move(savedPath);
         } else {
-            if (!(r->mRandUsed) && !mCachedPath) {
-                mCachedPath = std::move(r->mCurrentPath);
-                mCachedPath->mCached = true;
-                mCachedPath->mParameters = parent.mParameters;
+            if (!(r->mRandUsed) && !cachedPath) {
+                cachedPath = std::move(r->mCurrentPath);
+                cachedPath->mCached = true;
+                for (CommandInfo& info: cachedPath->mCommandInfo)
+                    info.mCachedPath = true;
+                cachedPath->mParameters = parent.mParameters;
                 r->mCurrentPath = std::make_unique<ASTcompiledPath>();
             } else {
                 r->mCurrentPath->mPath.remove_all();
@@ -712,14 +776,75 @@ namespace AST {
                     mChildChange.addEntropy(ent);
                 break;
             }
-            case CompilePhase::Simplify:
+            case CompilePhase::Simplify: {
                 Simplify(mLoopArgs);
                 mLoopBody.compile(ph);
                 mFinallyBody.compile(ph);
+                // Compose the constant terms of the loop adjustment once
+                ASTexpression* r = mChildChange.simplify();     // always returns nullptr
+                assert(r == nullptr);
+                hoistInvariants();
+                if (mLoopBody.mBody.size() == 1) {
+                    const ASTreplacement* body = mLoopBody.mBody.front().get();
+                    if (typeid(*body) == typeid(ASTreplacement) &&
+                        body->mRepType == replacement)
+                        mBatchBody = body;
+                }
                 break;
+            }
+        }
+    }
+    
+    static void
+    HoistInvariants(ASTrepContainer& body, ASThoister& hoister)
+    {
+        for (rep_ptr& rep: body.mBody) {
+            if (ASTloop* loop = dynamic_cast<ASTloop*>(rep.get())) {
+                // Only the loop arguments are evaluated before the inner loop
+                // takes over; its body has its own hoisted values
+                hoister.hoist(loop->mLoopArgs);
+                continue;
+            }
+            
+            hoister.hoist(rep->mChildChange);
+            if (rep->mShapeSpec.argSource == ASTruleSpecifier::DynamicArgs)
+                hoister.hoist(rep->mShapeSpec.arguments);
+            
+            if (ASTtransform* trans = dynamic_cast<ASTtransform*>(rep.get())) {
+                hoister.hoist(trans->mExpHolder);
+                HoistInvariants(trans->mBody, hoister);
+            } else if (ASTif* iff = dynamic_cast<ASTif*>(rep.get())) {
+                hoister.hoist(iff->mCondition);
+                HoistInvariants(iff->mThenBody, hoister);
+                HoistInvariants(iff->mElseBody, hoister);
+            } else if (ASTswitch* sw = dynamic_cast<ASTswitch*>(rep.get())) {
+                hoister.hoist(sw->mSwitchExp);
+                for (auto&& _case: sw->mCases)
+                    HoistInvariants(*(_case.second), hoister);
+                HoistInvariants(sw->mElseBody, hoister);
+            } else if (ASTdefine* def = dynamic_cast<ASTdefine*>(rep.get())) {
+                if (def->mDefineType == ASTdefine::StackDefine)
+                    hoister.hoist(def->mExpression);
+            } else if (ASTpathOp* pop = dynamic_cast<ASTpathOp*>(rep.get())) {
+                hoister.hoist(pop->mArguments);
+            } else if (ASTpathCommand* pcmd = dynamic_cast<ASTpathCommand*>(rep.get())) {
+                hoister.hoist(pcmd->mParameters);
+            }
         }
     }
     
+    void
+    ASTloop::hoistInvariants()
+    {
+        // Subexpressions of the loop body and the loop adjustment that do not
+        // depend on the loop index, or on anything computed inside the loop,
+        // are computed once per traversal of the loop.
+        ASThoister hoister(mLoopBody.mParameters.front().mStackIndex);
+        hoister.hoist(mChildChange);
+        HoistInvariants(mLoopBody, hoister);
+        mHoistedCount = hoister.count();
+    }
+    
     void
     ASTloop::compileLoopMod()
     {
@@ -89,8 +89,15 @@ namespace AST {
             size_t s = r->mStackSize;
             if (getParams && parent.mParameters)
                 r->initStack(parent.mParameters.get());
-            for (const rep_ptr& rep: mBody)
+            // With split seeds each child's seed is split from the seed
+            // that the body starts with, by the child's index
+            const Rand64 bodySeed = r->mCurrentSeed;
+            Rand64::result_type index = 0;
+            for (const rep_ptr& rep: mBody) {
+                if (r->mSplitSeeds)
+                    r->mCurrentSeed = bodySeed.split(index++);
                 rep->traverse(parent, tr, r);
+            }
             r->unwindStack(s, mParameters);
         }
         void compile(CompilePhase ph, ASTloop* loop = nullptr, ASTdefine* def = nullptr);
@@ -110,6 +117,8 @@ namespace AST {
         ASTrepContainer mFinallyBody;
         int mLoopIndexName;
         std::string mLoopName;
+        int mHoistedCount;
+        const ASTreplacement* mBatchBody;   // loop body if it is a single shape
         
         static void setupLoop(double& start, double& end, double& step, 
                               const ASTexpression* e, const yy::location& loc,
@@ -122,6 +131,10 @@ namespace AST {
         void traverse(const Shape& parent, bool tr, RendererAST* r) const override;
         void compile(CompilePhase ph) override;
         void compileLoopMod();
+    private:
+        void hoistInvariants();
+        void traverseShape(Shape& loopChild, StackType& index,
+                           double end, double step, RendererAST* r) const;
     };
     class ASTtransform: public ASTreplacement {
     public:
@@ -191,7 +204,6 @@ namespace AST {
     public:
         enum WeightTypes { NoWeight = 1, PercentWeight = 2, ExplicitWeight = 4};
         ASTrepContainer mRuleBody;
-        mutable cpath_ptr mCachedPath;
         double mWeight;
         bool isPath;
         int mNameIndex;
@@ -200,14 +212,14 @@ namespace AST {
         static bool compareLT(const ASTrule* a, const ASTrule* b);
         
         ASTrule(int ruleIndex, double weight, bool percent, const yy::location& loc)
-        : ASTreplacement(nullptr, loc, rule), mCachedPath(nullptr),
+        : ASTreplacement(nullptr, loc, rule),
           mWeight(weight <= 0.0 ? 1.0 : weight), isPath(false), mNameIndex(ruleIndex),
           weightType(percent ? PercentWeight : ExplicitWeight) {
               if (weight <= 0.0)
                   CfdgError::Warning(loc, "Rule weight coerced to 1.0");
           };
         ASTrule(int ruleIndex, const yy::location& loc)
-        : ASTreplacement(nullptr, loc, rule), mCachedPath(nullptr),
+        : ASTreplacement(nullptr, loc, rule),
           mWeight(1.0), isPath(false), mNameIndex(ruleIndex), weightType(NoWeight) { };
         ASTrule(int i);
         ~ASTrule() override;
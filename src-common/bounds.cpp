@@ -47,6 +47,22 @@ Bounds::Bounds(const agg::trans_affine& trans, pathIterator& helper, double scal
     }
 }
 
+bool
+Bounds::overlapsDisk(const agg::trans_affine& trns, double radius) const
+{
+    // The transformed disk fits in a disk scaled by the largest singular
+    // value of the linear part of the transform
+    double sum = trns.sx * trns.sx + trns.shx * trns.shx +
+                 trns.shy * trns.shy + trns.sy * trns.sy;
+    double det = trns.determinant();
+    double stretch = sqrt(0.5 * (sum + sqrt(fmax(0.0, sum * sum - 4.0 * det * det))));
+    double r = radius * stretch * (1.0 + 1e-6);
+    if (!myfinite(r))
+        return true;
+    return trns.tx + r >= mMin_X && trns.tx - r <= mMax_X &&
+           trns.ty + r >= mMin_Y && trns.ty - r <= mMax_Y;
+}
+
 Bounds
 Bounds::interpolate(const Bounds& other, double alpha) const
 {
@@ -175,3 +191,11 @@ Bounds::update(const agg::trans_affine& trns, pathIterator& helper, double scale
     merge(b);
 }
 
+void
+Bounds::updateHull(const agg::trans_affine& trns, const AST::CommandInfo& attr)
+{
+    Bounds b;
+    if (pathIterator::hullRect(trns, attr, b.mMin_X, b.mMin_Y, b.mMax_X, b.mMax_Y))
+        merge(b);
+}
+
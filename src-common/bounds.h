@@ -92,6 +92,13 @@ class Bounds {
         void merge(const agg::point_d& p) { merge(p.x, p.y); }
         // merge a point into this bounds
     
+        bool contains(const Bounds& b) const
+        {
+            return valid() && b.valid() &&
+                   b.mMin_X >= mMin_X && b.mMax_X <= mMax_X &&
+                   b.mMin_Y >= mMin_Y && b.mMax_Y <= mMax_Y;
+        }
+    
         Bounds operator+(const Bounds& other) const
         { Bounds t(*this); t.merge(other); return t; }
         
@@ -123,8 +130,15 @@ class Bounds {
         
         void gather(const Bounds& other, double weight);
         
+        bool overlapsDisk(const agg::trans_affine& trns, double radius) const;
+        // false if a disk of the given radius around the origin cannot
+        // overlap this bounds after it is transformed
+        
         void update(const agg::trans_affine& trns, pathIterator& helper, 
                     double scale, const AST::CommandInfo& attr);
+        void updateHull(const agg::trans_affine& trns, const AST::CommandInfo& attr);
+        // merge a box that holds the shape, which can be bigger than the
+        // shape but doesn't need its curves flattened
     
         double  mMin_X, mMin_Y, mMax_X, mMax_Y;
 };
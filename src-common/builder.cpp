@@ -204,7 +204,7 @@ Builder::IncludeFile(const std::string& fname)
 {
     std::string path =
         m_CFDG->system()->relativeFilePath(*m_currentPath, fname.c_str());
-    std::unique_ptr<std::istream> input(m_CFDG->system()->openFileForRead(path));
+    std::unique_ptr<std::istream> input(m_CFDG->openSource(path));
     if (!input || !input->good()) {
         m_CFDG->system()->error();
         mErrorOccured = true;
@@ -659,6 +659,8 @@ Builder::MakeFunction(str_ptr name, exp_ptr args, const yy::location& nameLoc,
     ASTfunction::FuncType t = ASTfunction::GetFuncType(*name);
     if (t == ASTfunction::Ftime || t == ASTfunction::Frame)
         m_CFDG->addParameter(CFDGImpl::FrameTime);
+    if (t == ASTfunction::Rand_Static)
+        m_CFDG->addParameter(CFDGImpl::StaticRandom);
     if (t != ASTfunction::NotAFunction)
         return new ASTfunction(*name, std::move(args), mSeed, nameLoc, argsLoc);
     
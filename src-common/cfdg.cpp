@@ -49,7 +49,7 @@ using namespace std;
 yy::location CfdgError::Default;
 double Renderer::Infinity = numeric_limits<double>::infinity();      // Ignore the gcc warning
 bool Renderer::AbortEverything = false;
-unsigned Renderer::ParamCount = 0;
+thread_local unsigned Renderer::ParamCount = 0;
 const CfgArray<std::string> CFDG::ParamNames = {
     "CF::AllowOverlap",
     "CF::Alpha",
@@ -152,8 +152,20 @@ AbstractSystem::tempFileForRead(const string& path)
     return new ifstream(path.c_str(), ios::binary);
 }
 
+bool
+AbstractSystem::fileStamp(const string&, FileStamp&)
+{
+    return false;
+}
+
 Canvas::~Canvas() = default;
 
+void
+Canvas::pixel(int x, int y, RGBA8 c)
+{
+    primitive(primShape::squareType, c, agg::trans_affine_translation(x + 0.5, y + 0.5));
+}
+
 Renderer::Renderer(int w, int h)
 : requestStop(false),
   requestFinishUp(false),
@@ -184,7 +196,7 @@ CFDG::ParseFile(const char* fname, AbstractSystem* system, int variation)
                                           yy::CfdgParser::token::CFDG3;
         
         yy::CfdgParser parser(b);
-        std::unique_ptr<istream> input(system->openFileForRead(fname));
+        std::unique_ptr<istream> input(b.m_CFDG->openSource(fname));
         if (!input || !input->good()) {
             system->error();
             system->message("Couldn't open rules file %s", fname);
@@ -50,6 +50,7 @@ using RGBA8 = agg::rgba16;
 namespace AST { class ASTcompiledPath; class ASTrule; class ASTparameter;
     using SymmList = std::vector<agg::trans_affine>;
     struct CommandInfo;
+    struct HoistedValues;
 }
 namespace agg { struct trans_affine_time; }
 class Shape;
@@ -102,10 +103,20 @@ class AbstractSystem {
     
         virtual std::string relativeFilePath(
             const std::string& base, const std::string& rel) = 0;
+
+        struct FileStamp {
+            uint64_t    size;
+            int64_t     mtime;      // nanoseconds
+            bool operator==(const FileStamp& o) const
+            { return size == o.size && mtime == o.mtime; }
+        };
+        virtual bool fileStamp(const std::string& path, FileStamp& stamp);
+            // false if the size and modification time can't be found
         
         struct Stats {
             int     shapeCount;     // finished shapes in image
             int     toDoCount;      // unfinished shapes still to expand
+            int     culledCount;    // unfinished shapes skipped as off canvas
             
             bool    inOutput;       // true if we are in the output loop
             bool    fullOutput;     // not an incremental output
@@ -119,7 +130,7 @@ class AbstractSystem {
             AbstractSystem* mSystem;
 
             Stats()
-                : shapeCount(0), toDoCount(0), inOutput(false),
+                : shapeCount(0), toDoCount(0), culledCount(0), inOutput(false),
                   fullOutput(false), finalOutput(false), showProgress(false),
                   outputCount(0), outputDone(0), outputTime(0), animating(false),
                   mSystem(nullptr) {}
@@ -155,15 +166,23 @@ class Canvas {
 
         virtual void primitive(int, RGBA8 , agg::trans_affine ) = 0;
         virtual void path(RGBA8, agg::trans_affine, const AST::CommandInfo& ) = 0;
+        virtual void pixel(int x, int y, RGBA8 c);
+            // blend c over the pixel whose lower left corner is (x, y),
+            // in the same coordinates as the primitive transforms
 
         Canvas(int width, int height) 
-        : mWidth(width), mHeight(height), mError(false) {}
+        : mWidth(width), mHeight(height), mError(false), mReuseStrokes(true),
+          mFastPrimitives(true) {}
         virtual ~Canvas();
         
         int mWidth;
         int mHeight;
         clock_t mTime;
         bool mError;
+        bool mReuseStrokes;     // stroke outlines can be shared by paths drawn
+                                // at nearly the same scale
+        bool mFastPrimitives;   // primitives can be drawn from single precision
+                                // geometry where the output can't tell
 };
 
 class Renderer;
@@ -188,6 +207,7 @@ class CFDG {
         bool uses16bitColor;
         bool usesTime;
         bool usesFrameTime;
+        bool usesStaticRandom;      // parse depends on the variation
         static const CfgArray<std::string>  ParamNames;
         static CFG lookupCfg(const std::string& name);
         virtual bool isTiled(agg::trans_affine* tr = nullptr, double* x = nullptr, double* y = nullptr) const = 0;
@@ -195,11 +215,13 @@ class CFDG {
         virtual bool isSized(double* x = nullptr, double* y = nullptr) const = 0;
         virtual bool isTimed(agg::trans_affine_time* t = nullptr) const = 0;
         virtual const agg::rgba& getBackgroundColor() = 0;
+        virtual bool sourcesChanged() const = 0;
+            // true if a file read by the parser is different now
 
     protected:
         CFDG()
         : usesColor(false), usesAlpha(false), uses16bitColor(false), 
-          usesTime(false), usesFrameTime(false)
+          usesTime(false), usesFrameTime(false), usesStaticRandom(false)
         { }
 };
 
@@ -210,6 +232,18 @@ class Renderer {
         virtual ~Renderer();
         
         virtual void setMaxShapes(int n) = 0;        
+        // Expand shapes in exactly the order of earlier versions, at some
+        // cost in speed
+        virtual void setLegacyOrder(bool legacy) = 0;
+        // Skip shapes that can't reach the canvas of a sized design
+        virtual void setCulling(bool cull) = 0;
+        // Derive each child shape's random seed from its parent's seed and
+        // its index instead of from the seeds of its older siblings. This
+        // changes the output of designs that use rand().
+        virtual void setSplitSeeds(bool split) = 0;
+        // Accumulate primitives smaller than this many pixels into a
+        // coverage buffer instead of keeping them as shapes, zero for never
+        virtual void setLevelOfDetail(double pixelArea) = 0;
         virtual void resetBounds() = 0;
         virtual void resetSize(int x, int y) = 0;
 
@@ -227,7 +261,7 @@ class Renderer {
     
         static double Infinity;
         static bool   AbortEverything;
-        static unsigned ParamCount;
+        static thread_local unsigned ParamCount;   // renderers are single-threaded
     protected:
         Renderer(int w, int h);
 };
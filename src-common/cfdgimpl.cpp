@@ -37,6 +37,11 @@
 #include "astreplacement.h"
 #include <limits>
 #include <cstring>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <typeinfo>
+#include <functional>
 #include "agg_trans_affine_time.h"
 
 #ifdef _WIN32
@@ -57,7 +62,7 @@ CFDGImpl::CFDGImpl(AbstractSystem* m)
 : mPostDtorCleanup(m), m_backgroundColor(1, 1, 1, 1), mStackSize(0),
   mInitShape(nullptr), m_system(m), m_Parameters(0),
   ParamDepth({NoParameter}),
-  mTileOffset(0, 0), needle(0, CfdgError::Default)
+  mTileOffset(0, 0)
 {
     // Initialize the shape table with the primitive shapes so that they get the
     // shape number that matches their primitive shape number.
@@ -104,26 +109,101 @@ CFDGImpl::getBackgroundColor()
     return m_backgroundColor;
 }
 
-void
+uint64_t
+CFDGImpl::HashText(std::istream& in, std::string* text)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    char buf[65536];
+    while (in) {
+        in.read(buf, sizeof(buf));
+        std::streamsize n = in.gcount();
+        for (std::streamsize i = 0; i < n; ++i) {
+            hash ^= static_cast<unsigned char>(buf[i]);
+            hash *= 1099511628211ULL;
+        }
+        if (text)
+            text->append(buf, static_cast<std::size_t>(n));
+    }
+    return hash;
+}
+
+bool
+CFDGImpl::HashFile(AbstractSystem* system, const std::string& path, uint64_t& hash)
+{
+    std::unique_ptr<std::istream> input(system->openFileForRead(path));
+    if (!input || !input->good())
+        return false;
+    hash = HashText(*input);
+    return true;
+}
+
+std::istream*
+CFDGImpl::openSource(const std::string& path)
+{
+    // The file is stamped before it is opened, so an edit made while the
+    // parser reads it leaves the stamp stale and is caught later
+    SourceFile source{path, false, {0, 0}, 0};
+    source.mStamped = m_system->fileStamp(path, source.mStamp);
+    std::unique_ptr<std::istream> input(m_system->openFileForRead(path));
+    if (!input || !input->good())
+        return nullptr;
+    if (!source.mStamped) {
+        // Hash the text that the parser gets, not a second read of the file
+        std::string text;
+        source.mHash = HashText(*input, &text);
+        input = std::make_unique<std::istringstream>(std::move(text));
+    }
+    auto same = [&path](const SourceFile& s) { return s.mPath == path; };
+    if (std::none_of(mSources.begin(), mSources.end(), same))
+        mSources.push_back(std::move(source));
+    return input.release();
+}
+
+bool
+CFDGImpl::sourcesChanged() const
+{
+    for (auto&& source: mSources) {
+        if (source.mStamped) {
+            AbstractSystem::FileStamp stamp;
+            if (!m_system->fileStamp(source.mPath, stamp) || !(stamp == source.mStamp))
+                return true;
+            continue;
+        }
+        uint64_t hash;
+        if (!HashFile(m_system, source.mPath, hash) || hash != source.mHash)
+            return true;
+    }
+    return false;
+}
+
+agg::rgba
 CFDGImpl::setBackgroundColor(RendererAST* r)
 {
+    // The background can depend on the variation, so each renderer keeps its
+    // own copy. The shared copy is for clients that ask the design directly.
+    agg::rgba color(1, 1, 1, 1);
     Modification white;
     white.m_Color = HSBColor(0.0, 0.0, 1.0, 1.0);
     if (hasParameter(CFG::Background, white, r)) {
-        white.m_Color.getRGBA(m_backgroundColor);
+        white.m_Color.getRGBA(color);
         if (!usesAlpha)
-            m_backgroundColor.a = 1.0;
+            color.a = 1.0;
     }
+    std::lock_guard<std::recursive_mutex> lock(mRendererMutex);
+    m_backgroundColor = color;
+    return color;
 }
 
 const ASTrule*
 CFDGImpl::findRule(int shapetype, double r)
 {
-    needle.mNameIndex = shapetype;
-    needle.mWeight = r;
-    
-    vector<ASTrule*>::iterator first = lower_bound(mRules.begin(), mRules.end(), 
-                                                   &needle, ASTrule::compareLT);
+    auto first = lower_bound(mRules.begin(), mRules.end(), shapetype,
+                             [r](const ASTrule* rule, int type)
+    {
+        return rule->mNameIndex < type || (rule->mNameIndex == type &&
+                                           rule->mWeight < r);
+    });
     if (first == mRules.end() || (*first)->mNameIndex != shapetype)
         throw CfdgError("Cannot find a rule for a shape (very helpful I know).");
     return *first;
@@ -138,6 +218,231 @@ CFDGImpl::findRule(int shapetype)
     return rule == mRules.end() ? nullptr : *rule;
 }
 
+namespace {
+    // A child of a rule, as the distance from the rule's origin to the
+    // child's origin and the largest stretch of the child's transform
+    struct RadiusEdge {
+        int     mShapeType;
+        double  mDistance;
+        double  mStretch;
+    };
+
+    const std::size_t MaxRadiusEdges = 65536;
+    const int MaxRadiusLoop = 4096;
+
+    bool
+    constantGeometry(const ASTmodification& m)
+    {
+        for (auto&& term: m.modExp) {
+            switch (term->modType) {
+                case ASTmodTerm::x:
+                case ASTmodTerm::y:
+                case ASTmodTerm::xyz:
+                case ASTmodTerm::transform:
+                case ASTmodTerm::size:
+                case ASTmodTerm::sizexyz:
+                case ASTmodTerm::rot:
+                case ASTmodTerm::skew:
+                case ASTmodTerm::flip:
+                case ASTmodTerm::modification:
+                    return false;
+                default:
+                    break;
+            }
+        }
+        return true;
+    }
+
+    // Collects the children of a rule body along with their transforms in
+    // the rule's coordinates. Returns false if some child can't be known
+    // before rendering.
+    bool
+    collectEdges(const ASTrepContainer& body, const agg::trans_affine& frame,
+                 std::vector<RadiusEdge>& edges);
+
+    bool
+    collectEdges(const ASTreplacement* rep, const agg::trans_affine& frame,
+                 std::vector<RadiusEdge>& edges)
+    {
+        if (dynamic_cast<const ASTdefine*>(rep))
+            return true;
+        if (const ASTif* ifRep = dynamic_cast<const ASTif*>(rep))
+            return collectEdges(ifRep->mThenBody, frame, edges) &&
+                   collectEdges(ifRep->mElseBody, frame, edges);
+        if (const ASTswitch* switchRep = dynamic_cast<const ASTswitch*>(rep)) {
+            for (auto&& c: switchRep->mCases)
+                if (!collectEdges(*c.second, frame, edges))
+                    return false;
+            return collectEdges(switchRep->mElseBody, frame, edges);
+        }
+        if (const ASTloop* loop = dynamic_cast<const ASTloop*>(rep)) {
+            double index = loop->mLoopData[0];
+            double end = loop->mLoopData[1];
+            double step = loop->mLoopData[2];
+            if (loop->mLoopArgs || !constantGeometry(loop->mChildChange))
+                return false;
+            agg::trans_affine loopFrame = frame;
+            for (int i = 0; step > 0.0 ? index < end : index > end; ++i) {
+                if (i >= MaxRadiusLoop || !collectEdges(loop->mLoopBody, loopFrame, edges))
+                    return false;
+                loopFrame.premultiply(loop->mChildChange.modData.m_transform);
+                index += step;
+            }
+            return collectEdges(loop->mFinallyBody, loopFrame, edges);
+        }
+        if (typeid(*rep) != typeid(ASTreplacement) ||
+            rep->mRepType != ASTreplacement::replacement ||
+            !constantGeometry(rep->mChildChange))
+            return false;
+        switch (rep->mShapeSpec.argSource) {
+            case ASTruleSpecifier::NoArgs:
+            case ASTruleSpecifier::DynamicArgs:
+            case ASTruleSpecifier::SimpleArgs:
+            case ASTruleSpecifier::SimpleParentArgs:
+                break;
+            default:
+                return false;   // the shape is chosen at render time
+        }
+        if (edges.size() >= MaxRadiusEdges)
+            return false;
+        agg::trans_affine child = frame;
+        child.premultiply(rep->mChildChange.modData.m_transform);
+        double sum = child.sx * child.sx + child.shx * child.shx +
+                     child.shy * child.shy + child.sy * child.sy;
+        double det = child.determinant();
+        double stretch = sqrt(0.5 * (sum + sqrt(fmax(0.0, sum * sum - 4.0 * det * det))));
+        double distance = hypot(child.tx, child.ty);
+        if (!isfinite(stretch) || !isfinite(distance))
+            return false;
+        edges.push_back(RadiusEdge{rep->mShapeSpec.shapeType, distance, stretch});
+        return true;
+    }
+
+    bool
+    collectEdges(const ASTrepContainer& body, const agg::trans_affine& frame,
+                 std::vector<RadiusEdge>& edges)
+    {
+        for (const rep_ptr& rep: body.mBody)
+            if (!collectEdges(rep.get(), frame, edges))
+                return false;
+        return true;
+    }
+}
+
+double
+CFDGImpl::expansionRadius(int shapetype)
+{
+    std::call_once(mExpansionRadiiOnce, [this]() { computeExpansionRadii(); });
+    if (shapetype < 0 || shapetype >= static_cast<int>(mExpansionRadii.size()))
+        return numeric_limits<double>::infinity();
+    return mExpansionRadii[shapetype];
+}
+
+// The radius of a rule is the largest over its children of the distance to
+// the child plus the child's radius times the child's stretch. For recursive
+// rules this is solved for each strongly connected group of rules. If every
+// stretch in the group is less than one then the radius is finite. Starting
+// from a bound that is known to be too big and applying the formula can only
+// shrink it toward the true radius, so stopping early is still safe.
+void
+CFDGImpl::computeExpansionRadii()
+{
+    const double Infinity = numeric_limits<double>::infinity();
+    size_t count = m_shapeTypes.size();
+    mExpansionRadii.assign(count, Infinity);
+    if (count < primShape::numTypes)
+        return;
+    mExpansionRadii[primShape::circleType] = 0.5005;   // curves bulge a little
+    mExpansionRadii[primShape::squareType] = sqrt(0.5);
+    mExpansionRadii[primShape::triangleType] = 0.5 / cos(M_PI / 6.0);
+
+    vector<vector<RadiusEdge>> edges(count);
+    vector<bool> bounded(count, false);
+    for (size_t t = primShape::numTypes; t < count; ++t)
+        bounded[t] = m_shapeTypes[t].shapeType == ruleType && m_shapeTypes[t].hasRules;
+    for (const ASTrule* rule: mRules) {
+        int t = rule->mNameIndex;
+        if (bounded[t] && (rule->isPath ||
+                           !collectEdges(rule->mRuleBody, agg::trans_affine(), edges[t])))
+        {
+            bounded[t] = false;
+            edges[t].clear();
+        }
+    }
+
+    // Tarjan's algorithm finds the groups children first
+    vector<int> index(count, -1), low(count, 0), stack;
+    vector<bool> onStack(count, false);
+    int nextIndex = 0;
+    std::function<void(int)> connect = [&](int v) {
+        index[v] = low[v] = nextIndex++;
+        stack.push_back(v);
+        onStack[v] = true;
+        for (auto&& e: edges[v]) {
+            int w = e.mShapeType;
+            if (w < primShape::numTypes) continue;
+            if (index[w] < 0) {
+                connect(w);
+                low[v] = min(low[v], low[w]);
+            } else if (onStack[w]) {
+                low[v] = min(low[v], index[w]);
+            }
+        }
+        if (low[v] != index[v])
+            return;
+        vector<int> group;
+        int w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            onStack[w] = false;
+            group.push_back(w);
+        } while (w != v);
+
+        // Bound the group by its outside children and the largest distance
+        // and stretch of the children inside the group
+        bool ok = true;
+        bool recursive = false;
+        double outside = 0.0, distance = 0.0, stretch = 0.0;
+        for (int g: group) {
+            ok = ok && bounded[g];
+            for (auto&& e: edges[g]) {
+                if (find(group.begin(), group.end(), e.mShapeType) != group.end()) {
+                    recursive = true;
+                    distance = max(distance, e.mDistance);
+                    stretch = max(stretch, e.mStretch);
+                } else {
+                    outside = max(outside, e.mDistance + e.mStretch * mExpansionRadii[e.mShapeType]);
+                }
+            }
+        }
+        if (!ok || !isfinite(outside) || (recursive && stretch >= 1.0))
+            return;
+        double bound = recursive ? max(outside, distance) / (1.0 - stretch) : outside;
+        for (int g: group)
+            mExpansionRadii[g] = bound;
+        if (!recursive)
+            return;
+        for (int pass = 0; pass < 100; ++pass) {
+            bool changed = false;
+            for (int g: group) {
+                double r = 0.0;
+                for (auto&& e: edges[g])
+                    r = max(r, e.mDistance + e.mStretch * mExpansionRadii[e.mShapeType]);
+                if (r < mExpansionRadii[g] * (1.0 - 1e-9)) {
+                    mExpansionRadii[g] = r;
+                    changed = true;
+                }
+            }
+            if (!changed)
+                break;
+        }
+    };
+    for (size_t t = primShape::numTypes; t < count; ++t)
+        if (index[t] < 0)
+            connect(static_cast<int>(t));
+}
+
 // Adds a new rule/path to the rule container. Updates information about the rule
 // in the m_shapeTypes[] vector. If the rule is known to have parameters then
 // they are copied into the new rule.
@@ -162,6 +467,7 @@ CFDGImpl::addParameter(Parameter p)
     usesColor = m_Parameters & Color;
     usesTime = m_Parameters & Time;
     usesFrameTime = m_Parameters & FrameTime;
+    usesStaticRandom = m_Parameters & StaticRandom;
 }
 
 RGBA8
@@ -541,10 +847,10 @@ CFDGImpl::reportStackDepth(int size)
 }
 
 void
-CFDGImpl::resetCachedPaths()
+CFDGImpl::addPermanentParams(const StackRule* p)
 {
-    for (ASTrule* rule: mRules)
-        rule->mCachedPath.reset();
+    if (p)
+        p->makePermanent(mPermanentParams.mParams);
 }
 
 AST::ASTdefine*
@@ -571,47 +877,62 @@ Renderer*
 CFDGImpl::renderer(const cfdg_ptr& ptr, int width, int height, double minSize,
                     int variation, double border)
 {
-    ASTexpression* startExp = ParamExp[CFG::StartShape].get();
+    // Several renderers can be made from one design, possibly from several
+    // threads. The startshape and the tile, size, and time settings do not
+    // depend on the variation, so they are set up by the first one.
+    std::lock_guard<std::recursive_mutex> lock(mRendererMutex);
     
-    if (!startExp) {
-        m_system->message("No startshape found");
-        m_system->error();
-        return nullptr;
-    }
-
-    if (ASTstartSpecifier* startSpec = dynamic_cast<ASTstartSpecifier*>(startExp)) {
+    if (!mInitShape) {
+        ASTexpression* startExp = ParamExp[CFG::StartShape].get();
+        
+        if (!startExp) {
+            m_system->message("No startshape found");
+            m_system->error();
+            return nullptr;
+        }
+        
+        ASTstartSpecifier* startSpec = dynamic_cast<ASTstartSpecifier*>(startExp);
+        if (!startSpec) {
+            CfdgError err(startExp->where, "Type error in startshape");
+            m_system->error();
+            m_system->syntaxError(err);
+            return nullptr;
+        }
+        
+        try {
+            Modification tiled;
+            Modification sized;
+            Modification timed;
+            if (hasParameter(CFG::Tile, tiled, nullptr)) {
+                mTileMod = tiled;
+                mTileOffset.x = mTileMod.m_transform.tx;
+                mTileOffset.y = mTileMod.m_transform.ty;
+                mTileMod.m_transform.tx = mTileMod.m_transform.ty = 0.0;
+            }
+            if (hasParameter(CFG::Size, sized, nullptr)) {
+                mSizeMod = sized;
+                mTileOffset.x = mSizeMod.m_transform.tx;
+                mTileOffset.y = mSizeMod.m_transform.ty;
+                mSizeMod.m_transform.tx = mSizeMod.m_transform.ty = 0.0;
+            }
+            if (hasParameter(CFG::Time, timed, nullptr)) {
+                mTimeMod = timed;
+            }
+        } catch (CfdgError& e) {
+            m_system->error();
+            m_system->syntaxError(e);
+            return nullptr;
+        }
+        
         ParamExp[CFG::StartShape].release();
         mInitShape = std::make_unique<ASTreplacement>(std::move(*startSpec), std::move(startSpec->mModification));
         mInitShape->mChildChange.addEntropy(mInitShape->mShapeSpec.entropyVal);
-    } else {
-        CfdgError err(startExp->where, "Type error in startshape");
-        m_system->error();
-        m_system->syntaxError(err);
-        return nullptr;
     }
 
     std::unique_ptr<RendererImpl> r;
     try {
         r = std::make_unique<RendererImpl>(ptr, width, height, minSize, variation, border);
-        Modification tiled;
-        Modification sized;
-        Modification timed;
         double       maxShape;
-        if (hasParameter(CFG::Tile, tiled, nullptr)) {
-            mTileMod = tiled;
-            mTileOffset.x = mTileMod.m_transform.tx;
-            mTileOffset.y = mTileMod.m_transform.ty;
-            mTileMod.m_transform.tx = mTileMod.m_transform.ty = 0.0;
-        }
-        if (hasParameter(CFG::Size, sized, nullptr)) {
-            mSizeMod = sized;
-            mTileOffset.x = mSizeMod.m_transform.tx;
-            mTileOffset.y = mSizeMod.m_transform.ty;
-            mSizeMod.m_transform.tx = mSizeMod.m_transform.ty = 0.0;
-        }
-        if (hasParameter(CFG::Time, timed, nullptr)) {
-            mTimeMod = timed;
-        }
         if (hasParameter(CFG::MaxShapes, maxShape, r.get())) {
             if (maxShape > 1)
                 r->setMaxShapes(static_cast<int>(maxShape));
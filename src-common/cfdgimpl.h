@@ -35,7 +35,10 @@
 #include <list>
 #include <map>
 #include <deque>
+#include <mutex>
 #include <type_traits>
+#include <cstdint>
+#include <iosfwd>
 
 #include "agg_color_rgba.h"
 #include "cfdg.h"
@@ -63,7 +66,17 @@ class CFDGImpl : public CFDG {
         };
     
         PostDtorCleanup mPostDtorCleanup;
+    
+        // Parameter blocks that are owned by the AST. They are freed after
+        // the rest of the AST is gone.
+        struct PermanentParams {
+            std::vector<const StackRule*> mParams;
+            ~PermanentParams() { StackRule::ReleasePermanent(mParams); }
+        };
+    
+        PermanentParams mPermanentParams;
         agg::rgba m_backgroundColor;
+        std::recursive_mutex mRendererMutex;
     
         int mStackSize;
 
@@ -97,6 +110,10 @@ class CFDGImpl : public CFDG {
         };
         
         std::vector<ShapeType> m_shapeTypes;
+
+        std::vector<double> mExpansionRadii;
+        std::once_flag mExpansionRadiiOnce;
+        void computeExpansionRadii();
     
     public:
         AST::rep_ptr mInitShape;
@@ -116,8 +133,6 @@ class CFDGImpl : public CFDG {
         Modification mSizeMod;
         Modification mTimeMod;
         agg::point_d mTileOffset;
-    
-        AST::ASTrule needle;
         
     public:
         CFDGImpl(AbstractSystem*);
@@ -132,7 +147,8 @@ class CFDGImpl : public CFDG {
         bool isSized(double* x = nullptr, double* y = nullptr) const override;
         bool isTimed(agg::trans_affine_time* t = nullptr) const override;
         const agg::rgba& getBackgroundColor() override;
-        void setBackgroundColor(RendererAST* r);
+        bool sourcesChanged() const override;
+        agg::rgba setBackgroundColor(RendererAST* r);
         void getSymmetry(AST::SymmList& syms, RendererAST* r);
     
         const AST::ASTexpression* hasParameter(CFG name) const;
@@ -142,6 +158,8 @@ class CFDGImpl : public CFDG {
 
     public:
         AbstractSystem* system() { return m_system; }
+        std::istream* openSource(const std::string& path);
+            // opens a file for the parser and records it in mSources
         
         Shape getInitialShape(RendererAST* r);
     
@@ -164,18 +182,37 @@ class CFDGImpl : public CFDG {
         const AST::ASTparameters* getShapeParams(int shapetype) const;
         int getShapeParamSize(int shapetype);
         int reportStackDepth(int size = 0); 
-        void resetCachedPaths();
+        double expansionRadius(int shapetype);
+            // the radius around the origin of a shape, in its own units,
+            // that holds everything it can expand into, or infinity
+        void addPermanentParams(const StackRule* p);
 
         AST::ASTdefine* declareFunction(int nameIndex, AST::ASTdefine* def);
         AST::ASTdefine* findFunction(int nameIndex);
 
-        enum Parameter {Color = 1, Alpha = 2, Time = 4, FrameTime = 8};
+        enum Parameter {Color = 1, Alpha = 2, Time = 4, FrameTime = 8, StaticRandom = 16};
         void addParameter(Parameter);
         void addParameter(CFG var, AST::exp_ptr e, unsigned depth);
 
         AST::ASTrepContainer    mCFDGcontents;
     
         std::list<std::string> fileNames;
+
+        // Each file that the parser read, in the order that they were read.
+        // The size and modification time are checked first so that an
+        // unchanged file isn't read again; the hash is only used when the
+        // system can't provide them. Both are taken by openSource(), as the
+        // parser opens the file.
+        struct SourceFile {
+            std::string                 mPath;
+            bool                        mStamped;
+            AbstractSystem::FileStamp   mStamp;
+            uint64_t                    mHash;
+        };
+        std::vector<SourceFile> mSources;
+        static uint64_t HashText(std::istream& in, std::string* text = nullptr);
+        static bool HashFile(AbstractSystem* system, const std::string& path,
+                             uint64_t& hash);
 };
 
 using cfdgi_ptr = std::shared_ptr<CFDGImpl>;
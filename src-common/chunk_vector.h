@@ -564,11 +564,11 @@ public:
         return (*this)[i];
     }
     
-    reference front() { return (*this)[_start]; }
-    const_reference front() const { return (*this)[_start]; }
+    reference front() { return (*this)[0]; }
+    const_reference front() const { return (*this)[0]; }
     
-    reference back() { return (*this)[_end - 1]; }
-    const_reference back() const { return (*this)[_end - 1]; }
+    reference back() { return (*this)[size() - 1]; }
+    const_reference back() const { return (*this)[size() - 1]; }
 
     iterator begin() noexcept             { return iterator(_chunks.data(), _start); }
     iterator end() noexcept               { return iterator(_chunks.data(), _end); }
@@ -56,7 +56,27 @@ struct imemstream: virtual membuf, std::istream {
 
 using namespace std;
 
-const char* prettyInt(unsigned long);
+const char*
+prettyInt(unsigned long v)
+{
+    if (!v) return "0";
+    
+    static char temp[32];
+    temp[31] = '\0';
+    int i = 0;
+    char* pos = temp + 30;
+    for(;;) {
+        *pos = '0' + (v % 10);
+        v = v / 10;
+        if (!v) return pos;
+        ++i;
+        --pos;
+        if (i % 3 == 0) {
+            *pos = ',';
+            --pos;
+        }
+    }
+}
 
 const char*
 CommandLineSystem::maybeLF()
@@ -140,6 +160,8 @@ CommandLineSystem::stats(const Stats& s)
         
         if (s.toDoCount > 0)
             cerr << " - " << prettyInt(static_cast<unsigned long>(s.toDoCount)) << " expansions to do";
+        if (s.culledCount > 0)
+            cerr << " - " << prettyInt(static_cast<unsigned long>(s.culledCount)) << " culled";
     }
 
     clearAndCR();
@@ -27,15 +27,95 @@
 #include "ast.h"
 #include "CmdInfo.h"
 #include "primShape.h"
+#include <functional>
+#include <cmath>
 
 static primShape dummy;
 
+namespace {
+    const int ScaleStepsPerOctave = 8;
+    const std::size_t MaxStrokeCacheBytes = 16 << 20;
+    const std::size_t StrokeEntryBytes = 128;   // key, node and bucket
+    
+    bool
+    isSimilarity(const agg::trans_affine& tr)
+    {
+        double eps = 1e-9 * (fabs(tr.sx) + fabs(tr.shx) + fabs(tr.shy) + fabs(tr.sy));
+        return (fabs(tr.sx - tr.sy) <= eps && fabs(tr.shx + tr.shy) <= eps) ||
+               (fabs(tr.sx + tr.sy) <= eps && fabs(tr.shx - tr.shy) <= eps);
+    }
+}
+
 pathIterator::pathIterator() 
 : curved(dummy), 
   curvedStroked(curved), curvedStrokedTrans(curvedStroked, unitTrans),
-  curvedTrans(curved, unitTrans), curvedTransStroked(curvedTrans)
+  curvedTrans(curved, unitTrans), curvedTransStroked(curvedTrans),
+  mReuseStrokes(false), mStrokeCacheBytes(0)
 { }
 
+std::size_t
+pathIterator::StrokeKeyHash::operator()(const StrokeKey& k) const
+{
+    std::size_t h = std::hash<double>()(k.mWidth);
+    h = h * 31 + std::hash<double>()(k.mMiterLimit);
+    h = h * 31 + static_cast<std::size_t>(k.mPathUID);
+    h = h * 31 + k.mIndex;
+    h = h * 31 + static_cast<std::size_t>(k.mFlags);
+    h = h * 31 + static_cast<std::size_t>(k.mScaleStep);
+    return h;
+}
+
+pathIterator::StrokeOutline*
+pathIterator::cachedStroke(const agg::trans_affine& tr, const AST::CommandInfo& attr)
+{
+    AST::UIDdatatype uid = attr.mPathUID.load();
+    if (!mReuseStrokes || (attr.mFlags & AST::CF_FILL) || !attr.mCachedPath || uid == 0 ||
+        uid == AST::CommandInfo::PathUIDDefault)
+        return nullptr;
+    
+    // An iso-width stroke of a path under a similarity transform is the
+    // transformed stroke of the path itself, with the same width
+    if ((attr.mFlags & AST::CF_ISO_WIDTH) && !isSimilarity(tr))
+        return nullptr;
+    double scale = sqrt(fabs(tr.determinant()));
+    if (!(scale > 0.0) || !std::isfinite(scale))
+        return nullptr;
+    
+    int step = static_cast<int>(ceil(log2(scale) * ScaleStepsPerOctave));
+    StrokeKey key{uid, attr.mIndex, attr.mFlags & 0x77, step,
+                  attr.mStrokeWidth, attr.mMiterLimit};
+    auto it = mStrokeCache.find(key);
+    if (it != mStrokeCache.end())
+        return &(it->second);
+    
+    if (mStrokeCacheBytes > MaxStrokeCacheBytes) {
+        mStrokeCache.clear();
+        mStrokeCacheBytes = 0;
+    }
+    
+    // Same as apply() for a stroke drawn at the stepped scale
+    double stepScale = exp2(static_cast<double>(step) / ScaleStepsPerOctave);
+    curved.attach(*attr.mPath);
+    curvedStroked.width(attr.mStrokeWidth);
+    curvedStroked.line_join(static_cast<agg::line_join_e>(attr.mFlags & 7));
+    curvedStroked.line_cap(static_cast<agg::line_cap_e>((attr.mFlags >> 4) & 7));
+    curvedStroked.miter_limit(attr.mMiterLimit);
+    curvedStroked.inner_join(agg::inner_round);
+    curvedStroked.approximation_scale(stepScale);
+    curved.approximation_scale(stepScale);
+    curved.angle_tolerance(attr.mStrokeWidth * stepScale > 1.0 ? 0.2 : 0.0);
+    
+    StrokeOutline& outline = mStrokeCache[key];
+    std::vector<StrokeOutline::Vertex>& vertices = outline.mVertices;
+    curvedStroked.rewind(attr.mIndex);
+    StrokeOutline::Vertex v;
+    while (!agg::is_stop(v.cmd = curvedStroked.vertex(&v.x, &v.y)))
+        vertices.push_back(v);
+    vertices.shrink_to_fit();
+    mStrokeCacheBytes += StrokeEntryBytes + vertices.size() * sizeof(v);
+    return &outline;
+}
+
 void
 pathIterator::apply(const AST::CommandInfo& attr, 
                     const agg::trans_affine& tr, 
@@ -96,6 +176,12 @@ pathIterator::addPath<agg::rasterizer_scanline_aa<> >(agg::rasterizer_scanline_a
                                                       const agg::trans_affine& tr,
                                                       const AST::CommandInfo& attr)
 {
+    if (StrokeOutline* outline = cachedStroke(tr, attr)) {
+        agg::conv_transform<StrokeOutline, const agg::trans_affine> outlineTrans(*outline, tr);
+        ras.add_path(outlineTrans);
+        return;
+    }
+    
     apply(attr, tr, 1.0);
     
     if (attr.mFlags & AST::CF_FILL) {
@@ -109,6 +195,60 @@ pathIterator::addPath<agg::rasterizer_scanline_aa<> >(agg::rasterizer_scanline_a
     }
 }
 
+bool
+pathIterator::hullRect(const agg::trans_affine& tr, const AST::CommandInfo& attr,
+                       double& minx, double& miny, double& maxx, double& maxy)
+{
+    // Curves stay inside the hull of their control points, so the vertices
+    // of the path storage, curve control points included, hold the path
+    agg::path_storage& path = *attr.mPath;
+    path.rewind(attr.mIndex);
+    bool empty = true;
+    double x, y;
+    unsigned cmd;
+    while (!agg::is_stop(cmd = path.vertex(&x, &y))) {
+        if (!agg::is_vertex(cmd))
+            continue;
+        tr.transform(&x, &y);
+        if (empty) {
+            minx = maxx = x;
+            miny = maxy = y;
+            empty = false;
+        } else {
+            if (x < minx) minx = x;
+            if (x > maxx) maxx = x;
+            if (y < miny) miny = y;
+            if (y > maxy) maxy = y;
+        }
+    }
+    if (empty || (attr.mFlags & AST::CF_FILL))
+        return !empty;
+    
+    // A stroke reaches half of its width from the path, further at miter
+    // joins and square caps
+    double reach = 0.5 * fabs(attr.mStrokeWidth);
+    agg::line_join_e join = static_cast<agg::line_join_e>(attr.mFlags & 7);
+    agg::line_cap_e cap = static_cast<agg::line_cap_e>((attr.mFlags >> 4) & 7);
+    double factor = 1.0;
+    if (join != agg::round_join && join != agg::bevel_join && attr.mMiterLimit > factor)
+        factor = attr.mMiterLimit;
+    if (cap == agg::square_cap && factor < M_SQRT2)
+        factor = M_SQRT2;
+    if (attr.mFlags & AST::CF_ISO_WIDTH) {
+        reach *= sqrt(fabs(tr.determinant()));
+    } else {
+        double sum = tr.sx * tr.sx + tr.shx * tr.shx + tr.shy * tr.shy + tr.sy * tr.sy;
+        double det = tr.determinant();
+        reach *= sqrt(0.5 * (sum + sqrt(fmax(0.0, sum * sum - 4.0 * det * det))));
+    }
+    reach = reach * factor * (1.0 + 1e-6) + 1e-9 * (maxx - minx + maxy - miny);
+    minx -= reach;
+    miny -= reach;
+    maxx += reach;
+    maxy += reach;
+    return true;
+}
+
 bool
 pathIterator::boundingRect(const agg::trans_affine& tr, 
                            const AST::CommandInfo& attr,
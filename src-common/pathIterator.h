@@ -32,6 +32,10 @@
 #include "agg_conv_curve.h"
 #include "agg_trans_affine.h"
 #include "agg_path_storage.h"
+#include "ast.h"
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
 
 namespace AST {
     struct CommandInfo;
@@ -51,6 +55,7 @@ public:
     CurvedStrokedTrans  curvedStrokedTrans;
     CurvedTrans         curvedTrans;
     CurvedTransStroked  curvedTransStroked;
+    bool                mReuseStrokes;
     
     pathIterator();
     ~pathIterator() = default;
@@ -63,6 +68,62 @@ public:
     bool boundingRect(const agg::trans_affine& tr, const AST::CommandInfo& attr,
                       double& minx, double& miny, double& maxx, double& maxy,
                       double scale);
+    static bool hullRect(const agg::trans_affine& tr, const AST::CommandInfo& attr,
+                         double& minx, double& miny, double& maxx, double& maxy);
+        // A box that holds the path, found without flattening the curves
+        // or stroking. It can be bigger than the path.
+
+private:
+    // Stroke outlines in path coordinates, for strokes drawn at nearly the
+    // same scale. The scale is rounded up to a step, so a shared outline is
+    // never coarser than the one it replaces. Only paths that are cached
+    // by the renderer are drawn again with the same UID, so only their
+    // strokes are kept.
+    struct StrokeKey {
+        AST::UIDdatatype    mPathUID;
+        unsigned            mIndex;
+        int                 mFlags;         // join and cap
+        int                 mScaleStep;
+        double              mWidth;
+        double              mMiterLimit;
+        bool operator==(const StrokeKey& o) const
+        {
+            return mPathUID == o.mPathUID && mIndex == o.mIndex &&
+                   mFlags == o.mFlags && mScaleStep == o.mScaleStep &&
+                   mWidth == o.mWidth && mMiterLimit == o.mMiterLimit;
+        }
+    };
+    struct StrokeKeyHash {
+        std::size_t operator()(const StrokeKey& k) const;
+    };
+    // A flattened outline, which is a vertex source for the rasterizer
+    class StrokeOutline {
+    public:
+        struct Vertex {
+            double      x, y;
+            unsigned    cmd;
+        };
+        std::vector<Vertex> mVertices;
+        
+        void rewind(unsigned) { mNext = 0; }
+        unsigned vertex(double* x, double* y)
+        {
+            if (mNext == mVertices.size())
+                return agg::path_cmd_stop;
+            const Vertex& v = mVertices[mNext++];
+            *x = v.x;
+            *y = v.y;
+            return v.cmd;
+        }
+    private:
+        std::size_t mNext = 0;
+    };
+    using StrokeCache = std::unordered_map<StrokeKey, StrokeOutline, StrokeKeyHash>;
+    StrokeCache         mStrokeCache;
+    std::size_t         mStrokeCacheBytes;
+    
+    StrokeOutline* cachedStroke(const agg::trans_affine& tr,
+                                const AST::CommandInfo& attr);
 };
 
 #endif
@@ -28,7 +28,7 @@
 
 RendererAST::RendererAST(int w, int h)
 : Renderer(w, h),
-  mMaxNatural(1000.0),
+  mHoisted(nullptr), mSplitSeeds(false), mMaxNatural(1000.0),
   mCurrentTime(0.0), mCurrentFrame(0.0),
   mCurrentPath(nullptr)
 { }
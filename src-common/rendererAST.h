@@ -28,6 +28,7 @@
 #include "cfdg.h"
 #include "CmdInfo.h"
 #include <array>
+#include <unordered_map>
 
 class RendererAST : public Renderer {
 public:
@@ -42,7 +43,10 @@ public:
             return (offset < 0) ? (mLogicalStackTop + offset) : (mCFstack.data() + offset);
         }
         
+        AST::HoistedValues* mHoisted;   // for the innermost loop
+        
         Rand64      mCurrentSeed;
+        bool        mSplitSeeds;    // see Renderer::setSplitSeeds()
         bool        mRandUsed;
     
         double      mMaxNatural;
@@ -60,6 +64,9 @@ public:
         unsigned     mNextIndex;
         AST::cpath_ptr mCurrentPath;
         AST::InfoCache::iterator mCurrentCommand;
+        // Compiled paths that do not depend on the random seed, kept per
+        // renderer so that the AST stays read-only while rendering
+        std::unordered_map<const AST::ASTrule*, AST::cpath_ptr> mCachedPaths;
     
         void init();
         static bool isNatural(RendererAST* r, double n);
@@ -35,6 +35,9 @@
 #include <stack>
 #include <cassert>
 #include <functional>
+#include <mutex>
+#include <limits>
+#include <queue>
 
 #ifdef _WIN32
 #include <float.h>
@@ -56,6 +59,7 @@ using namespace AST;
 
 //#define DEBUG_SIZES
 unsigned int RendererImpl::MoveFinishedAt = 0;     // when this many, move to file
+unsigned int RendererImpl::MoveSplatsAt = 0;       // when this many, move to file
 unsigned int RendererImpl::MoveUnfinishedAt = 0;   // when this many, move to files
 unsigned int RendererImpl::MaxMergeFiles = 0;      // maximum number of files to merge at once
 
@@ -66,28 +70,32 @@ RendererImpl::RendererImpl( const cfdg_ptr& cfdg,
                             int width, int height, double minSize,
                             int variation, double border)
     : RendererAST(width, height), m_cfdg(std::dynamic_pointer_cast<CFDGImpl>(cfdg)),
-      m_canvas(nullptr), mColorConflict(false),
-      m_maxShapes(500000000), mVariation(variation), m_border(border), 
+      m_canvas(nullptr), mColorConflict(false), mBackgroundColor(1, 1, 1, 1),
+      m_maxShapes(500000000), mCulling(false), mHullBounds(false), mSplatArea(0.0),
+      mSplatsSoFar(0), mSplatWidth(0), mSplatHeight(0), mVariation(variation), m_border(border), 
       mScaleArea(0.0), mScale(0.0), m_currScale(0.0), m_currArea(0.0), 
       m_minSize(minSize), mFrameTimeBounds(1.0, -Renderer::Infinity, Renderer::Infinity),
       shapeCopies(primShape::shapeMap), shapeMap{}
 {
     assert(m_cfdg);
-    if (MoveFinishedAt == 0) {
+    static std::once_flag sizesSet;     // renderers can be made on several threads
+    std::call_once(sizesSet, [this]() {
 #ifndef DEBUG_SIZES
         size_t mem = m_cfdg->system()->getPhysicalMemory();
         if (mem == 0) {
-            MoveFinishedAt = MoveUnfinishedAt = 2000000;
+            MoveFinishedAt = MoveUnfinishedAt = MoveSplatsAt = 2000000;
         } else {
             MoveFinishedAt = MoveUnfinishedAt = static_cast<unsigned int>(mem / (sizeof(FinishedShape) * 4));
+            MoveSplatsAt = static_cast<unsigned int>(mem / (sizeof(Splat) * 4));
         }
         MaxMergeFiles      =      200; // maximum number of files to merge at once
 #else
         MoveFinishedAt     =    1000; // when this many, move to file
+        MoveSplatsAt       =    1000; // when this many, move to file
         MoveUnfinishedAt   =     200; // when this many, move to files
         MaxMergeFiles      =       4; // maximum number of files to merge at once
 #endif
-    }
+    });
     
     for (size_t i = 0; i < shapeMap.size(); ++i)
         shapeMap[i] = CommandInfo(&shapeCopies[i]);
@@ -132,7 +140,7 @@ RendererImpl::init()
     mTotalArea = 0.0;
     
     m_minArea = 0.3; 
-    m_outputSoFar = m_stats.shapeCount = m_stats.toDoCount = 0;
+    m_outputSoFar = m_stats.shapeCount = m_stats.toDoCount = m_stats.culledCount = 0;
     double minSize = m_minSize;
     m_cfdg->hasParameter(CFG::MinimumSize, minSize, this);
     minSize = (minSize <= 0.0) ? 0.3 : minSize;
@@ -160,7 +168,7 @@ RendererImpl::init()
     mCurrentPath = std::make_unique<AST::ASTcompiledPath>();
     
     m_cfdg->getSymmetry(mSymmetryOps, this);
-    m_cfdg->setBackgroundColor(this);
+    mBackgroundColor = m_cfdg->setBackgroundColor(this);
 }
 
 void
@@ -214,17 +222,20 @@ RendererImpl::cleanup()
 {
     // delete temp files before checking for abort
     m_finishedFiles.clear();
+    mSplatFiles.clear();
     m_unfinishedFiles.clear();
 
     // Delete all shapes and parameters (except those in the AST)
     mUnfinishedShapes.clear();
     mFinishedShapes.clear();
+    mSplats.clear();
+    mSplatsSoFar = 0;
     
     // Delete the global definitions
     unwindStack(0, m_cfdg->mCFDGcontents.mParameters);
     
     mCurrentPath.reset();
-    m_cfdg->resetCachedPaths();
+    mCachedPaths.clear();
 }
 
 void
@@ -233,6 +244,30 @@ RendererImpl::setMaxShapes(int n)
     m_maxShapes = n ? n : 400000000;
 }
 
+void
+RendererImpl::setLegacyOrder(bool legacy)
+{
+    mUnfinishedShapes.setLegacy(legacy);
+}
+
+void
+RendererImpl::setCulling(bool cull)
+{
+    mCulling = cull;
+}
+
+void
+RendererImpl::setSplitSeeds(bool split)
+{
+    mSplitSeeds = split;
+}
+
+void
+RendererImpl::setLevelOfDetail(double pixelArea)
+{
+    mSplatArea = pixelArea;
+}
+
 void
 RendererImpl::resetBounds()
 {
@@ -248,6 +283,8 @@ RendererImpl::outputPrep(Canvas* canvas)
     if (canvas) {
         m_width = canvas->mWidth;
         m_height = canvas->mHeight;
+        canvas->mReuseStrokes = !mUnfinishedShapes.legacy();
+        canvas->mFastPrimitives = !mUnfinishedShapes.legacy();
         if (m_tiled || m_frieze) {
             agg::trans_affine tr;
             m_cfdg->isTiled(&tr);
@@ -307,9 +344,7 @@ RendererImpl::run(Canvas * canvas, bool partialDraw)
             break;
 
         // Get the largest unfinished shape
-        Shape s(std::move(mUnfinishedShapes.front()));
-        pop_heap(mUnfinishedShapes.begin(), mUnfinishedShapes.end());
-        mUnfinishedShapes.pop_back();
+        Shape s(mUnfinishedShapes.pop());
         m_stats.toDoCount--;
         
         try {
@@ -497,6 +532,8 @@ RendererImpl::animate(Canvas* canvas, int frames, bool zoom)
     
     const bool ftime = m_cfdg->usesFrameTime;
     zoom = zoom && !ftime;
+    if (zoom && canvas)
+        canvas->mFastPrimitives = false;    // rounding would make shapes shimmer
     if (ftime)
         cleanup();
 
@@ -506,7 +543,7 @@ RendererImpl::animate(Canvas* canvas, int frames, bool zoom)
     int curr_height = m_height;
     rescaleOutput(curr_width, curr_height, true);
     
-    m_canvas->start(true, m_cfdg->getBackgroundColor(),
+    m_canvas->start(true, mBackgroundColor,
         curr_width, curr_height);
     m_canvas->end();
 
@@ -603,11 +640,22 @@ RendererImpl::processShape(Shape& s)
     if (m_cfdg->getShapeType(s.mShapeType) == CFDGImpl::ruleType &&
         m_cfdg->shapeHasRules(s.mShapeType)) 
     {
+        // Sized designs clip to the canvas, so a shape that can't expand
+        // into it can be dropped. Tiles and friezes wrap around and symmetry
+        // moves shapes after expansion, so those are never culled.
+        if (mCulling && m_sized && !m_tiled && !m_frieze && mSymmetryOps.empty()) {
+            double radius = m_cfdg->expansionRadius(s.mShapeType);
+            if (isfinite(radius) &&
+                !mBounds.overlapsDisk(s.mWorldState.m_transform, radius))
+            {
+                m_stats.culledCount++;
+                return;
+            }
+        }
         // only add it if it's big enough (or if there are no finished shapes yet)
         if (!mBounds.valid() || (area * mScaleArea >= m_minArea)) {
             m_stats.toDoCount++;
-            mUnfinishedShapes.push_back(std::move(s));
-            push_heap(mUnfinishedShapes.begin(), mUnfinishedShapes.end());
+            mUnfinishedShapes.push(std::move(s));
         }
     } else if (m_cfdg->getShapeType(s.mShapeType) == CFDGImpl::pathType) {
         const ASTrule* rule = m_cfdg->findRule(s.mShapeType, 0.0);
@@ -630,7 +678,7 @@ RendererImpl::processPrimShape(Shape& s, const ASTrule* path)
     } else {
         for (auto&& xform: mSymmetryOps) {
             Shape sym(s);
-            sym.mWorldState.m_transform.multiply(xform);
+            simdAffine::multiply(sym.mWorldState.m_transform, xform);
             processPrimShapeSiblings(std::move(sym), path);
         }
     }
@@ -650,8 +698,21 @@ RendererImpl::processPrimShapeSiblings(Shape&& s, const ASTrule* path)
         mPathBounds.invalidate();
         m_drawingMode = false;
         if (path) {
+            // The hull of a path is much quicker to find than its exact
+            // bounds. It is good enough if it is inside the bounds of the
+            // design, because then the exact bounds can't grow them.
+            bool exact = mUnfinishedShapes.legacy();
             mOpsOnly = false;
+            mHullBounds = !exact;
             path->traversePath(s, this);
+            mHullBounds = false;
+            if (!exact && !m_tiled && !m_sized &&
+                !mBounds.contains(mPathBounds.dilate(mShapeBorder)))
+            {
+                mCurrentArea = 0.0;
+                mPathBounds.invalidate();
+                path->traversePath(s, this);
+            }
         } else {
             CommandInfo* attr = nullptr;
             if (s.mShapeType < 3) attr = &(shapeMap[s.mShapeType]);
@@ -673,6 +734,8 @@ RendererImpl::processPrimShapeSiblings(Shape&& s, const ASTrule* path)
     }
     FinishedShape fs(std::move(s), m_stats.shapeCount, mPathBounds);
     fs.mWorldState.m_Z.sz = mCurrentArea;
+    if (!path)
+        fs.mColor = getColor(fs.mWorldState.m_Color);
     if (!m_cfdg->usesTime) {
         fs.mWorldState.m_time.tbegin = mTotalArea;
         fs.mWorldState.m_time.tend = Renderer::Infinity;
@@ -703,7 +766,28 @@ RendererImpl::processPrimShapeSiblings(Shape&& s, const ASTrule* path)
         system()->message("A shape got too big.");
         return;
     }
-    mFinishedShapes.push_back(fs);
+    if (!makeSplat(fs))
+        mFinishedShapes.push_back(fs);
+}
+
+bool
+RendererImpl::makeSplat(const FinishedShape& s)
+{
+    // The scale only shrinks as the design grows, so a shape that is small
+    // now is at least as small in the final image. A long thin shape can
+    // have a small area and still span several pixels, so its extent must
+    // also fit in about a pixel.
+    if (mSplatArea <= 0.0 || m_tiled || m_frieze || m_cfdg->usesTime ||
+        !primShape::isPrimShape(s.mShapeType) || s.mShapeType == primShape::fillType ||
+        !(s.mWorldState.m_Z.sz * mScaleArea < mSplatArea) || !s.mBounds.valid() ||
+        !((s.mBounds.mMax_X - s.mBounds.mMin_X) * mScale <= 1.0 &&
+          (s.mBounds.mMax_Y - s.mBounds.mMin_Y) * mScale <= 1.0))
+        return false;
+    const agg::trans_affine& tr = s.mWorldState.m_transform;
+    mSplats.push_back(Splat{tr.tx, tr.ty, s.mWorldState.m_Z.tz,
+                            static_cast<float>(s.mWorldState.m_Z.sz),
+                            s.mWorldState.m_ColorAssignment, s.mColor});
+    return true;
 }
 
 void
@@ -735,6 +819,8 @@ RendererImpl::fileIfNecessary()
 {
     if (mFinishedShapes.size() > MoveFinishedAt)
         moveFinishedToFile();
+    if (mSplats.size() > MoveSplatsAt)
+        moveSplatsToFile();
 
     if (mUnfinishedShapes.size() > MoveUnfinishedAt)
         moveUnfinishedToTwoFiles();
@@ -759,10 +845,6 @@ RendererImpl::moveUnfinishedToTwoFiles()
                       m_unfinishedFiles.back().type().c_str(), num1, num2);
 
     size_t count = mUnfinishedShapes.size() / 3;
-
-    UnfinishedContainer::iterator usi = mUnfinishedShapes.begin(),
-                                  use = mUnfinishedShapes.end();
-    usi += count;
     
     if (f1 && f1->good() && f2 && f2->good()) {
         AbstractSystem::Stats outStats = m_stats;
@@ -773,29 +855,21 @@ RendererImpl::moveUnfinishedToTwoFiles()
         *f2 << outStats.outputCount;
         outStats.outputCount = static_cast<int>(count * 2);
         outStats.showProgress = true;
-        // Split the bottom 2/3 of the heap between the two files
-        while (usi != use) {
-            usi->write(*((m_unfinishedInFilesCount & 1) ? f1 : f2));
-            ++usi;
+        // Split the smallest 2/3 of the shapes between the two files
+        mUnfinishedShapes.trim(count, [&](const Shape& s) {
+            s.write(*((m_unfinishedInFilesCount & 1) ? f1 : f2));
             ++m_unfinishedInFilesCount;
             ++outStats.outputDone;
             if (requestUpdate) {
                 system()->stats(outStats);
                 requestUpdate = false;
             }
-            if (requestStop || requestFinishUp)
-                return;
-        }
+            return !(requestStop || requestFinishUp);
+        });
     } else {
         system()->message("Cannot open temporary file for expansions");
         requestStop = true;
-        return;
     }
-
-    // Remove the written shapes, heap property remains intact
-    static const Shape neverActuallyUsed;
-    mUnfinishedShapes.resize(count, neverActuallyUsed);
-    assert(is_heap(mUnfinishedShapes.begin(), mUnfinishedShapes.end()));
 }
 
 void
@@ -816,9 +890,8 @@ RendererImpl::getUnfinishedFromFile()
         outStats.showProgress = true;
         istream_iterator<Shape> it(*f);
         istream_iterator<Shape> eit;
-        back_insert_iterator< UnfinishedContainer > sendto(mUnfinishedShapes);
         while (it != eit) {
-            *sendto = *it;
+            mUnfinishedShapes.push(Shape(*it));
             ++it;
             ++outStats.outputDone;
             if (requestUpdate) {
@@ -831,43 +904,7 @@ RendererImpl::getUnfinishedFromFile()
     } else {
         system()->message("Cannot open temporary file for expansions");
         requestStop = true;
-        return;
-    }
-    system()->message("Resorting expansions");
-    fixupHeap();
-}
-
-void
-RendererImpl::fixupHeap()
-{
-    // Restore heap property to mUnfinishedShapes
-    auto first = mUnfinishedShapes.begin();
-    auto last = mUnfinishedShapes.end();
-    using difference_type = UnfinishedContainer::iterator::difference_type;
-    difference_type n = last - first;
-    if (n < 2)
-        return;
-
-    AbstractSystem::Stats outStats = m_stats;
-    outStats.mSystem = system();
-    outStats.outputCount = static_cast<int>(n);
-    outStats.outputDone = 0;
-    outStats.showProgress = true;
-    
-    last = first;
-    ++last;
-    for (difference_type i = 1; i < n; ++i) {
-        push_heap(first, ++last);
-    
-        ++outStats.outputDone;
-        if (requestUpdate) {
-            system()->stats(outStats);
-            requestUpdate = false;
-        }
-        if (requestStop || requestFinishUp)
-            return;
     }
-    assert(is_heap(mUnfinishedShapes.begin(), mUnfinishedShapes.end()));
 }
 
 //-------------------------------------------------------------------------////
@@ -907,6 +944,118 @@ RendererImpl::moveFinishedToFile()
     mFinishedShapes.clear();
 }
 
+void
+RendererImpl::moveSplatsToFile()
+{
+    mSplatFiles.emplace_back(system(), AbstractSystem::ShapeTemp, ++mFinishedFileCount);
+    
+    unique_ptr<ostream> f(mSplatFiles.back().forWrite());
+
+    if (f && f->good()) {
+        std::sort(mSplats.begin(), mSplats.end());
+        for (const Splat& p: mSplats) {
+            f->write(reinterpret_cast<const char*>(&p), sizeof(Splat));
+            if (requestStop)
+                return;
+        }
+    } else {
+        system()->message("Cannot open temporary file for shapes");
+        requestStop = true;
+        return;
+    }
+
+    mSplats.clear();
+    mSplatsSoFar = 0;
+}
+
+// Merges sorted splats from temp files and from memory, like OutputMerge
+// does for finished shapes
+class RendererImpl::SplatMerge
+{
+public:
+    void addTempFile(TempFile& t)
+    {
+        mStreams.emplace_back(t.forRead());
+        insertNext(mStreams.size() - 1);
+    }
+    void addSplats(SplatContainer::iterator begin, SplatContainer::iterator end)
+    {
+        mSplatsNext = begin;
+        mSplatsEnd = end;
+        insertNext(InMemory);
+    }
+    
+    bool empty() const { return mSieve.empty(); }
+    const Splat& top() const { return mSieve.top().first; }
+    Splat pop()
+    {
+        SievePair next = mSieve.top();
+        mSieve.pop();
+        insertNext(next.second);
+        return next.first;
+    }
+    
+private:
+    static const size_t InMemory = numeric_limits<size_t>::max();
+    
+    using SievePair = pair<Splat, size_t>;
+    struct After {
+        bool operator()(const SievePair& a, const SievePair& b) const
+        { return b.first < a.first; }
+    };
+    
+    vector<unique_ptr<istream>> mStreams;
+    SplatContainer::iterator    mSplatsNext;
+    SplatContainer::iterator    mSplatsEnd;
+    priority_queue<SievePair, vector<SievePair>, After> mSieve;
+    
+    void insertNext(size_t i)
+    {
+        if (i == InMemory) {
+            if (mSplatsNext != mSplatsEnd)
+                mSieve.emplace(*mSplatsNext++, i);
+        } else {
+            Splat p;
+            istream* f = mStreams[i].get();
+            if (f && f->read(reinterpret_cast<char*>(&p), sizeof(Splat)))
+                mSieve.emplace(p, i);
+        }
+    }
+};
+
+void
+RendererImpl::mergeSplatFiles()
+{
+    while (mSplatFiles.size() > MaxMergeFiles) {
+        TempFile t(system(), AbstractSystem::MergeTemp, ++mFinishedFileCount);
+        
+        {
+            SplatMerge merger;
+            for (unsigned i = 0; i < MaxMergeFiles; ++i)
+                merger.addTempFile(mSplatFiles[i]);
+            
+            std::unique_ptr<ostream> f(t.forWrite());
+            if (!f) {
+                system()->message("Cannot open temporary file for shapes");
+                requestStop = true;
+                return;
+            }
+            system()->message("Merging temp files %d through %d",
+                              mSplatFiles.front().number(),
+                              mSplatFiles[MaxMergeFiles - 1].number());
+            
+            while (!merger.empty()) {
+                Splat p = merger.pop();
+                f->write(reinterpret_cast<const char*>(&p), sizeof(Splat));
+            }
+        }   // end scope for merger and f
+        
+        for (unsigned i = 0; i < MaxMergeFiles; ++i)
+            mSplatFiles.pop_front();
+        mSplatFiles.push_back(std::move(t));
+    }
+}
+
 //-------------------------------------------------------------------------////
 
 void RendererImpl::rescaleOutput(int& curr_width, int& curr_height, bool final)
@@ -1010,21 +1159,32 @@ RendererImpl::drawShape(const FinishedShape& s)
     if (s.mShapeType != primShape::fillType && (!isfinite(a) || a < m_minArea))
         return;
     
-    if (m_tiledCanvas && s.mShapeType != primShape::fillType) {
+    if (s.mShapeType != primShape::fillType) {
         Bounds b = s.mBounds;
         m_currTrans.transform(&b.mMin_X, &b.mMin_Y);
         m_currTrans.transform(&b.mMax_X, &b.mMax_Y);
-        m_tiledCanvas->tileTransform(b);
+        bool legacy = mUnfinishedShapes.legacy();
+        if (m_tiledCanvas) {
+            if (!m_tiledCanvas->tileTransform(b, !legacy))
+                return;
+        } else if (!legacy && b.valid()) {
+            // Reject shapes that can't touch the canvas before any
+            // vertices are generated
+            if (b.mMin_X > b.mMax_X) std::swap(b.mMin_X, b.mMax_X);
+            if (b.mMin_Y > b.mMax_Y) std::swap(b.mMin_Y, b.mMax_Y);
+            if (b.mMax_X < m_currClip.mMin_X || b.mMin_X > m_currClip.mMax_X ||
+                b.mMax_Y < m_currClip.mMin_Y || b.mMin_Y > m_currClip.mMax_Y)
+                return;
+        }
     }
-
+    
     if (m_cfdg->getShapeType(s.mShapeType) == CFDGImpl::pathType) {
         //mRenderer.m_canvas->path(s.mColor, tr, *s.mAttributes);
         const ASTrule* rule = m_cfdg->findRule(s.mShapeType, 0.0);
         rule->traversePath(s, this);
     } else {
-        RGBA8 color = m_cfdg->getColor(s.mWorldState.m_Color);
         if (primShape::isPrimShape(s.mShapeType)) {
-            m_canvas->primitive(s.mShapeType, color, tr);
+            m_canvas->primitive(s.mShapeType, s.mColor, tr);
         } else {
             system()->error();
             system()->message("Non drawable shape with no rules: %s",
@@ -1035,13 +1195,97 @@ RendererImpl::drawShape(const FinishedShape& s)
     }
 }
 
+void
+RendererImpl::addSplat(const Splat& p)
+{
+    if (requestStop) throw Stopped();
+    if (!mFinal  &&  requestFinishUp) throw Stopped();
+
+    // Each splat is spread over the four pixels nearest to its center and
+    // covers a fraction of each that is its share of its area. The splats
+    // in a pixel are blended over each other in the buffer and then the
+    // result is blended over the canvas once, by drawSplats().
+    double area = p.mArea * m_currArea;
+    if (!isfinite(area) || area < m_minArea)
+        return;         // same as drawShape()
+    m_stats.outputDone += 1;
+
+    double x = p.mX, y = p.mY;
+    m_currTrans.transform(&x, &y);
+    x -= 0.5;
+    y -= 0.5;
+    if (!(x > -1.0 && y > -1.0 && x < mSplatWidth && y < mSplatHeight))
+        return;
+    int ix = static_cast<int>(floor(x));
+    int iy = static_cast<int>(floor(y));
+    float fx = static_cast<float>(x - ix);
+    float fy = static_cast<float>(y - iy);
+    float cover = static_cast<float>(area * p.mColor.a / RGBA8::base_mask);
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+            int px = ix + i, py = iy + j;
+            if (px < 0 || py < 0 || px >= mSplatWidth || py >= mSplatHeight)
+                continue;
+            float w = (i ? fx : 1.0f - fx) * (j ? fy : 1.0f - fy) * cover;
+            if (w <= 0.0f)
+                continue;
+            SplatPixel& sp = mSplatBuffer[py * mSplatWidth + px];
+            if (w > 1.0f) w = 1.0f;
+            float under = 1.0f - w;
+            sp.mCover = w + sp.mCover * under;
+            sp.mRed   = w * p.mColor.r + sp.mRed   * under;
+            sp.mGreen = w * p.mColor.g + sp.mGreen * under;
+            sp.mBlue  = w * p.mColor.b + sp.mBlue  * under;
+        }
+    }
+}
+
+void
+RendererImpl::drawSplats()
+{
+    if (mSplatBuffer.empty()) return;
+
+    for (auto&& pixel: mSplatBuffer) {
+        const SplatPixel& sp = pixel.second;
+        float alpha = sp.mCover;
+        using value_type = RGBA8::value_type;
+        RGBA8 c(static_cast<value_type>(sp.mRed   / sp.mCover + 0.5f),
+                static_cast<value_type>(sp.mGreen / sp.mCover + 0.5f),
+                static_cast<value_type>(sp.mBlue  / sp.mCover + 0.5f),
+                static_cast<value_type>(alpha * RGBA8::base_mask + 0.5f));
+        m_canvas->pixel(pixel.first % mSplatWidth, pixel.first / mSplatWidth, c);
+    }
+    // A new map, because clear() costs as much as the largest it has been
+    mSplatBuffer = std::unordered_map<int, SplatPixel>();
+}
+
+RGBA8
+RendererImpl::getColor(const HSBColor& hsb)
+{
+    // The key is the exact bits of the color, so a hit gives the same result
+    // as converting the color again
+    static_assert(sizeof(HSBColor) == 4 * sizeof(uint64_t), "Unexpected HSBColor layout");
+    uint64_t bits[4];
+    memcpy(bits, &hsb, sizeof(bits));
+    uint64_t hash = bits[0];
+    for (int i = 1; i < 4; ++i)
+        hash = (hash ^ (hash >> 29) ^ bits[i]) * 0x9e3779b97f4a7c15ULL;
+    ColorCacheEntry& e = mColorCache[(hash >> 32) % mColorCache.size()];
+    if (!e.mValid || memcmp(&e.mHSB, &hsb, sizeof(HSBColor)) != 0) {
+        e.mHSB = hsb;
+        e.mColor = m_cfdg->getColor(hsb);
+        e.mValid = true;
+    }
+    return e.mColor;
+}
+
 
 void RendererImpl::output(bool final)
 {
     if (!m_canvas)
         return;
         
-    if (!final &&  !m_finishedFiles.empty())
+    if (!final && (!m_finishedFiles.empty() || !mSplatFiles.empty()))
         return; // don't do updates once we have temp files
         
     m_stats.inOutput = true;
@@ -1057,20 +1301,56 @@ void RendererImpl::output(bool final)
     m_stats.outputDone = m_outputSoFar;
     
     if (final) {
-        if (mFinishedShapes.size() > 10000)
+        if (mFinishedShapes.size() + mSplats.size() > 10000)
             system()->message("Sorting shapes...");
         std::sort(mFinishedShapes.begin(), mFinishedShapes.end());
+        std::sort(mSplats.begin(), mSplats.end());
     }
+    if (m_outputSoFar == 0)
+        mSplatsSoFar = 0;
+    mSplatWidth = curr_width;
+    mSplatHeight = curr_height;
+    mSplatBuffer = std::unordered_map<int, SplatPixel>();  // if a draw was stopped
     
-    m_canvas->start(m_outputSoFar == 0, m_cfdg->getBackgroundColor(),
+    m_canvas->start(m_outputSoFar == 0, mBackgroundColor,
         curr_width, curr_height);
 
+    // The canvas centers the output in itself, so it shows a margin around
+    // the output if it is larger. Shapes whose bounds are entirely outside of
+    // this get skipped. The extra pixels cover the flattening error in path
+    // bounds and the enlargement of tiny shapes by the canvas.
+    const double ClipMargin = 8.0;
+    double marginX = (m_canvas->mWidth  - curr_width)  / 2.0 + ClipMargin;
+    double marginY = (m_canvas->mHeight - curr_height) / 2.0 + ClipMargin;
+    m_currClip.mMin_X = -marginX;
+    m_currClip.mMin_Y = -marginY;
+    m_currClip.mMax_X = curr_width  + marginX;
+    m_currClip.mMax_Y = curr_height + marginY;
+
     m_drawingMode = true;
     //OutputDraw draw(*this, final);
     try {
-        forEachShape(final, [=](const FinishedShape& s) {
+        // Splats are drawn in order with the shapes in the final output,
+        // and after the new shapes in the partial outputs
+        SplatMerge splats;
+        if (final) {
+            mergeSplatFiles();
+            for (auto&& file: mSplatFiles)
+                splats.addTempFile(file);
+        }
+        splats.addSplats(mSplats.begin() + mSplatsSoFar, mSplats.end());
+        forEachShape(final, [&](const FinishedShape& s) {
+            if (final) {
+                while (!splats.empty() && splats.top().before(s))
+                    this->addSplat(splats.pop());
+                this->drawSplats();
+            }
             this->drawShape(s);
         });
+        while (!splats.empty())
+            addSplat(splats.pop());
+        drawSplats();
+        mSplatsSoFar = mSplats.size();
     }
     catch (Stopped&) { }
     catch (exception& e) {
@@ -1095,14 +1375,17 @@ RendererImpl::processPathCommand(const Shape& s, const AST::CommandInfo* attr)
 {
     if (m_drawingMode) {
         if (m_canvas && attr) {
-            RGBA8 color = m_cfdg->getColor(s.mWorldState.m_Color);
+            RGBA8 color = getColor(s.mWorldState.m_Color);
             agg::trans_affine tr = s.mWorldState.m_transform;
             tr *= m_currTrans;
             m_canvas->path(color, tr, *attr);
         }
     } else {
         if (attr) {
-            mPathBounds.update(s.mWorldState.m_transform, m_pathIter, mScale, *attr);
+            if (mHullBounds)
+                mPathBounds.updateHull(s.mWorldState.m_transform, *attr);
+            else
+                mPathBounds.update(s.mWorldState.m_transform, m_pathIter, mScale, *attr);
             mCurrentArea = fabs((mPathBounds.mMax_X - mPathBounds.mMin_X) *
                                 (mPathBounds.mMax_Y - mPathBounds.mMin_Y));
         }
@@ -38,6 +38,7 @@
 #include <set>
 #include <array>
 #include <type_traits>
+#include <unordered_map>
 
 #include "agg_trans_affine.h"
 #include "agg_trans_affine_time.h"
@@ -50,6 +51,7 @@
 #include "CmdInfo.h"
 #include "pathIterator.h"
 #include "chunk_vector.h"
+#include "shapeQueue.h"
 
 class ShapeOp;
 namespace AST {
@@ -67,6 +69,10 @@ class RendererImpl : public RendererAST {
         ~RendererImpl();
     
         void setMaxShapes(int n) override;
+        void setLegacyOrder(bool legacy) override;
+        void setCulling(bool cull) override;
+        void setSplitSeeds(bool split) override;
+        void setLevelOfDetail(double pixelArea) override;
         void resetBounds() override;
         void resetSize(int x, int y) override;
         void initBounds();
@@ -85,6 +91,32 @@ class RendererImpl : public RendererAST {
         void forEachShape(bool final, ShapeFunction op);
         void processPrimShapeSiblings(Shape&& s, const AST::ASTrule* attr);
         void drawShape(const FinishedShape& s);
+        bool makeSplat(const FinishedShape& s);
+
+        // A primitive too small to be worth keeping as a shape. Splats are
+        // kept in the same order as finished shapes, and moved to temp files
+        // with them, and are drawn by adding them to a coverage buffer, which
+        // is blended into the canvas each time a finished shape comes up to
+        // draw over them.
+        struct Splat {
+            double  mX, mY;         // center
+            double  mZ;
+            float   mArea;
+            unsigned mOrder;
+            RGBA8   mColor;
+            bool operator<(const Splat& o) const
+            { return mZ == o.mZ ? mOrder < o.mOrder : mZ < o.mZ; }
+            bool before(const FinishedShape& s) const
+            {
+                return mZ == s.mWorldState.m_Z.tz ?
+                    mOrder < s.mWorldState.m_ColorAssignment : mZ < s.mWorldState.m_Z.tz;
+            }
+        };
+        using SplatContainer = chunk_vector<Splat, 12>;
+        class SplatMerge;
+        void addSplat(const Splat& p);
+        void drawSplats();
+        RGBA8 getColor(const HSBColor& hsb);
 
         void output(bool final);
         void outputPartial() { output(false); }
@@ -98,10 +130,11 @@ class RendererImpl : public RendererAST {
         bool isDone();
         void fileIfNecessary();
         void moveFinishedToFile();
+        void moveSplatsToFile();
+        void mergeSplatFiles();
         void moveUnfinishedToTwoFiles();
         void getUnfinishedFromFile();
         AbstractSystem* system() { return m_cfdg->system(); }
-        void fixupHeap();
     
         void init();
         void cleanup();
@@ -112,6 +145,7 @@ class RendererImpl : public RendererAST {
         pathIterator m_pathIter;
     
         bool        mColorConflict;
+        agg::rgba   mBackgroundColor;
 
         int m_maxShapes;
         bool m_tiled;
@@ -121,13 +155,27 @@ class RendererImpl : public RendererAST {
         double m_frieze_size;
         bool m_drawingMode;
         bool mFinal;
+        bool mCulling;
+        bool mHullBounds;       // path bounds from control points
+        double mSplatArea;      // in pixels
 
         using FinishedContainer = chunk_vector<FinishedShape, 10>;
         FinishedContainer mFinishedShapes;
-        using UnfinishedContainer = chunk_vector<Shape, 10>;
-        UnfinishedContainer mUnfinishedShapes;
+        ShapeQueue mUnfinishedShapes;
+
+        SplatContainer mSplats;
+        std::size_t mSplatsSoFar;
+        struct SplatPixel {
+            float   mCover;
+            float   mRed, mGreen, mBlue;    // premultiplied by coverage
+        };
+        // Only the pixels that splats have touched since the last blend
+        std::unordered_map<int, SplatPixel> mSplatBuffer;
+        int mSplatWidth;
+        int mSplatHeight;
 
         std::deque<TempFile> m_finishedFiles;
+        std::deque<TempFile> mSplatFiles;
         std::deque<TempFile> m_unfinishedFiles;
         int mFinishedFileCount;
         int mUnfinishedFileCount;
@@ -153,6 +201,7 @@ class RendererImpl : public RendererAST {
         agg::trans_affine_time mTimeBounds;
         agg::trans_affine_time mFrameTimeBounds;
         agg::trans_affine m_currTrans;
+        Bounds m_currClip;      // visible canvas in m_currTrans coordinates
         unsigned int m_outputSoFar;
     
         std::vector<agg::trans_affine> mSymmetryOps;
@@ -162,8 +211,18 @@ class RendererImpl : public RendererAST {
     
         primShape::primShapes_t shapeCopies;
         std::array<AST::CommandInfo, primShape::numTypes> shapeMap;
+
+        // Direct-mapped cache of HSB to output color conversions, most
+        // designs only use a handful of colors
+        struct ColorCacheEntry {
+            HSBColor mHSB;
+            RGBA8    mColor;
+            bool     mValid = false;
+        };
+        std::array<ColorCacheEntry, 1024> mColorCache;
     
         static unsigned int MoveFinishedAt;     // when this many, move to file
+        static unsigned int MoveSplatsAt;       // when this many, move to file
         static unsigned int MoveUnfinishedAt;   // when this many, move to files
         static unsigned int MaxMergeFiles;      // maximum number of files to merge at once
     
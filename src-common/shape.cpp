@@ -68,7 +68,7 @@ Modification::isFinite() const
 bool
 Modification::merge(const Modification& m)
 {
-    m_transform.premultiply(m.m_transform);
+    simdAffine::premultiply(m_transform, m.m_transform);
     m_Z.premultiply(m.m_Z);
     m_time.premultiply(m.m_time);
     mRand64Seed ^= m.mRand64Seed;
@@ -137,6 +137,7 @@ FinishedShape::write(std::ostream& os) const
 {
     ShapeBase::write(os);
     os.write(reinterpret_cast<const char*>(&mBounds), sizeof(Bounds));
+    os.write(reinterpret_cast<const char*>(&mColor), sizeof(mColor));
     writeParams(os);
 }
 
@@ -145,6 +146,7 @@ FinishedShape::read(std::istream& is)
 {
     ShapeBase::read(is);
     is.read(reinterpret_cast<char *>(&mBounds), sizeof(Bounds));
+    is.read(reinterpret_cast<char *>(&mColor), sizeof(mColor));
     readParams(is);
 }
 
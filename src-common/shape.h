@@ -38,6 +38,7 @@
 #include "agg_trans_affine.h"
 #include "agg_trans_affine_1D.h"
 #include "agg_trans_affine_time.h"
+#include "simdAffine.h"
 #include "agg_color_rgba.h"
 #include "HSBColor.h"
 #include "Rand64.h"
@@ -71,7 +72,7 @@ class Modification {
         }
         Modification& operator*=(const Modification& m)
         {
-            m_transform.premultiply(m.m_transform);
+            simdAffine::premultiply(m_transform, m.m_transform);
             m_Z.premultiply(m.m_Z);
             m_time.premultiply(m.m_time);
             HSBColor::Adjust(m_Color, m_ColorTarget, m.m_Color, m.m_ColorTarget,
@@ -152,6 +153,7 @@ protected:
 class FinishedShape : public Shape {
 public:
     Bounds mBounds;
+    agg::rgba16 mColor{0, 0, 0, 0};    // output color of primitive shapes
     FinishedShape() = default;
     FinishedShape(Shape&& s, int order, const Bounds& b) noexcept
     {
@@ -170,6 +172,7 @@ public:
         mAreaCache = o.mAreaCache;
         mParameters = o.mParameters;
         mBounds = o.mBounds;
+        mColor = o.mColor;
         return *this;
     }
     FinishedShape& operator=(FinishedShape&& o) noexcept {
@@ -179,6 +182,7 @@ public:
         mAreaCache = o.mAreaCache;
         mParameters = std::move(o.mParameters);
         mBounds = o.mBounds;
+        mColor = o.mColor;
         return *this;
     }
 
@@ -0,0 +1,207 @@
+// shapeQueue.h
+// this file is part of Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+
+#ifndef INCLUDE_SHAPEQUEUE_H
+#define INCLUDE_SHAPEQUEUE_H
+
+#include "shape.h"
+#include "chunk_vector.h"
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#include <cmath>
+
+// Priority queue of unfinished shapes, largest first. The shapes are parked
+// in a slab and only handles to them are moved around.
+//
+// Normally the handles are bucketed by the binary exponent of the shape area
+// and each bucket is first in, first out. So shapes come out largest first to
+// within a factor of two, which is all that expansion needs, and push and pop
+// take constant time. In legacy mode the handles form a binary heap that pops
+// shapes in exactly the order that the heap of shapes in earlier versions did.
+
+class ShapeQueue {
+public:
+    explicit ShapeQueue(bool legacy = false)
+    : mLegacy(legacy), mCount(0), mTop(-1) { }
+
+    bool legacy() const { return mLegacy; }
+    void setLegacy(bool legacy)
+    {
+        assert(empty());
+        mLegacy = legacy;
+    }
+
+    bool empty() const { return mCount == 0; }
+    std::size_t size() const { return mCount; }
+
+    void push(Shape&& s)
+    {
+        double area = s.area();
+        handle_t h = park(std::move(s));
+        ++mCount;
+        if (mLegacy) {
+            mHeap.push_back(HeapEntry{area, h});
+            std::push_heap(mHeap.begin(), mHeap.end());
+        } else {
+            int key = Key(area);
+            mBuckets[key].push_back(h);
+            mTop = std::max(mTop, key);
+        }
+    }
+
+    Shape pop()
+    {
+        assert(!empty());
+        handle_t h;
+        if (mLegacy) {
+            h = mHeap.front().mHandle;
+            std::pop_heap(mHeap.begin(), mHeap.end());
+            mHeap.pop_back();
+        } else {
+            h = mBuckets[mTop].front();
+            mBuckets[mTop].pop_front();
+            while (mTop >= 0 && mBuckets[mTop].empty())
+                --mTop;
+        }
+        --mCount;
+        mFree.push_back(h);
+        return Shape(std::move(mSlab[h]));
+    }
+
+    void clear()
+    {
+        for (auto&& bucket: mBuckets)
+            bucket.clear();
+        mHeap.clear();
+        mFree.clear();
+        mSlab.clear();
+        mCount = 0;
+        mTop = -1;
+    }
+
+    // Keeps the largest keep shapes, more or less, and passes the others to
+    // f. If f returns false then nothing is removed.
+    template <typename F>
+    bool trim(std::size_t keep, F f)
+    {
+        if (keep >= mCount)
+            return true;
+
+        // The kept shapes move to a fresh slab so that the memory for the
+        // others is released
+        SlabContainer slab;
+        auto moveToSlab = [&](handle_t h) {
+            slab.push_back(std::move(mSlab[h]));
+            return static_cast<handle_t>(slab.size() - 1);
+        };
+
+        if (mLegacy) {
+            // The top of the heap is a heap
+            for (std::size_t i = keep; i < mHeap.size(); ++i)
+                if (!f(mSlab[mHeap[i].mHandle]))
+                    return false;
+            mHeap.resize(keep);
+            for (HeapEntry& e: mHeap)
+                e.mHandle = moveToSlab(e.mHandle);
+        } else {
+            std::vector<handle_t> kept;
+            kept.reserve(keep);
+            for (int key = mTop; key >= 0; --key) {
+                for (handle_t h: mBuckets[key]) {
+                    if (kept.size() < keep)
+                        kept.push_back(h);
+                    else if (!f(mSlab[h]))
+                        return false;
+                }
+            }
+            for (auto&& bucket: mBuckets)
+                bucket.clear();
+            mTop = -1;
+            for (handle_t h: kept) {
+                int key = Key(mSlab[h].area());
+                mBuckets[key].push_back(moveToSlab(h));
+                mTop = std::max(mTop, key);
+            }
+        }
+        mSlab.swap(slab);
+        mFree.clear();
+        mCount = keep;
+        return true;
+    }
+
+private:
+    using handle_t = std::uint32_t;
+    using SlabContainer = chunk_vector<Shape, 10>;
+    using Bucket = chunk_vector<handle_t, 8>;
+
+    // Binary exponents of finite doubles, plus one for zero
+    enum consts_e : int {
+        MinExponent = -1075,
+        MaxExponent = 1024,
+        BucketCount = MaxExponent - MinExponent + 1
+    };
+
+    static int Key(double area)
+    {
+        if (!(area > 0.0))
+            return 0;
+        int exp;
+        std::frexp(area, &exp);
+        return std::min<int>(std::max<int>(exp, MinExponent), MaxExponent) - MinExponent;
+    }
+
+    // Same ordering as Shape::operator<(), without a trip to the slab
+    struct HeapEntry {
+        double   mArea;
+        handle_t mHandle;
+        bool operator<(const HeapEntry& o) const { return mArea < o.mArea; }
+    };
+
+    handle_t park(Shape&& s)
+    {
+        if (mFree.empty()) {
+            assert(mSlab.size() < UINT32_MAX);
+            mSlab.push_back(std::move(s));
+            return static_cast<handle_t>(mSlab.size() - 1);
+        }
+        handle_t h = mFree.back();
+        mFree.pop_back();
+        mSlab[h] = std::move(s);
+        return h;
+    }
+
+    bool mLegacy;
+    std::size_t mCount;
+    int mTop;                       // highest non-empty bucket
+    SlabContainer mSlab;
+    std::vector<handle_t> mFree;    // unused slab entries
+    std::vector<HeapEntry> mHeap;   // for legacy mode
+    std::array<Bucket, BucketCount> mBuckets;
+};
+
+#endif  // INCLUDE_SHAPEQUEUE_H
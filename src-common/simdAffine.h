@@ -0,0 +1,126 @@
+// simdAffine.h
+// this file is part of Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+
+#ifndef INCLUDE_SIMDAFFINE_H
+#define INCLUDE_SIMDAFFINE_H
+
+#include "agg_trans_affine.h"
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#if defined(__FMA__)
+#define SIMDAFFINE_MADD256(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define SIMDAFFINE_MADD(a, b, c) _mm_fmadd_pd(a, b, c)
+#else
+#define SIMDAFFINE_MADD256(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#define SIMDAFFINE_MADD(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#endif
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMDAFFINE_SSE2
+#define SIMDAFFINE_MADD(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#endif
+
+// Inline vector versions of agg::trans_affine::multiply() and premultiply(),
+// which are the innermost step of every shape expansion. The columns of the
+// matrix are adjacent pairs of doubles (sx,shy), (shx,sy), (tx,ty), so each
+// result column is a linear combination of the other matrix's columns. The
+// vector code does the same multiplies and adds in the same order as agg,
+// so the results are identical to the last bit. When the target has fused
+// multiply-add the compiler turns agg's a*b + c*d into fma(a, b, c*d), so
+// the vector code does too.
+
+namespace simdAffine {
+    static_assert(offsetof(agg::trans_affine, shy) == offsetof(agg::trans_affine, sx) + sizeof(double) &&
+                  offsetof(agg::trans_affine, shx) == offsetof(agg::trans_affine, sx) + 2 * sizeof(double) &&
+                  offsetof(agg::trans_affine, sy) == offsetof(agg::trans_affine, sx) + 3 * sizeof(double) &&
+                  offsetof(agg::trans_affine, tx) == offsetof(agg::trans_affine, sx) + 4 * sizeof(double) &&
+                  offsetof(agg::trans_affine, ty) == offsetof(agg::trans_affine, sx) + 5 * sizeof(double),
+                  "Unexpected trans_affine layout");
+
+    // r = a * b in agg order, i.e., apply a then b. r may alias a or b.
+    inline void
+    product(agg::trans_affine& r, const agg::trans_affine& a, const agg::trans_affine& b)
+    {
+#if defined(__AVX__)
+        __m256d b01 = _mm256_loadu_pd(&b.sx);                               // b.sx  b.shy b.shx b.sy
+        __m256d b0 = _mm256_permute2f128_pd(b01, b01, 0x00);                // b.sx  b.shy b.sx  b.shy
+        __m256d b1 = _mm256_permute2f128_pd(b01, b01, 0x11);                // b.shx b.sy  b.shx b.sy
+        __m128d b2 = _mm_loadu_pd(&b.tx);
+        __m256d a01 = _mm256_loadu_pd(&a.sx);                               // a.sx  a.shy a.shx a.sy
+        __m256d a0 = _mm256_unpacklo_pd(a01, a01);                          // a.sx  a.sx  a.shx a.shx
+        __m256d a1 = _mm256_unpackhi_pd(a01, a01);                          // a.shy a.shy a.sy  a.sy
+        __m128d atx = _mm_set1_pd(a.tx);
+        __m128d aty = _mm_set1_pd(a.ty);
+        __m256d r01 = SIMDAFFINE_MADD256(a0, b0, _mm256_mul_pd(a1, b1));
+        __m128d r2 = _mm_add_pd(SIMDAFFINE_MADD(atx, _mm256_castpd256_pd128(b0),
+                                                _mm_mul_pd(aty, _mm256_castpd256_pd128(b1))), b2);
+        _mm256_storeu_pd(&r.sx, r01);
+        _mm_storeu_pd(&r.tx, r2);
+#elif defined(SIMDAFFINE_SSE2)
+        __m128d b0 = _mm_loadu_pd(&b.sx);
+        __m128d b1 = _mm_loadu_pd(&b.shx);
+        __m128d b2 = _mm_loadu_pd(&b.tx);
+        __m128d r0 = SIMDAFFINE_MADD(_mm_set1_pd(a.sx), b0,
+                                     _mm_mul_pd(_mm_set1_pd(a.shy), b1));
+        __m128d r1 = SIMDAFFINE_MADD(_mm_set1_pd(a.shx), b0,
+                                     _mm_mul_pd(_mm_set1_pd(a.sy), b1));
+        __m128d r2 = _mm_add_pd(SIMDAFFINE_MADD(_mm_set1_pd(a.tx), b0,
+                                                _mm_mul_pd(_mm_set1_pd(a.ty), b1)), b2);
+        _mm_storeu_pd(&r.sx, r0);
+        _mm_storeu_pd(&r.shx, r1);
+        _mm_storeu_pd(&r.tx, r2);
+#else
+        double t0 = a.sx  * b.sx + a.shy * b.shx;
+        double t2 = a.shx * b.sx + a.sy  * b.shx;
+        double t4 = a.tx  * b.sx + a.ty  * b.shx + b.tx;
+        double t1 = a.sx  * b.shy + a.shy * b.sy;
+        double t3 = a.shx * b.shy + a.sy  * b.sy;
+        double t5 = a.tx  * b.shy + a.ty  * b.sy + b.ty;
+        r.sx = t0; r.shy = t1; r.shx = t2; r.sy = t3; r.tx = t4; r.ty = t5;
+#endif
+    }
+
+    // Same as t.multiply(m)
+    inline void
+    multiply(agg::trans_affine& t, const agg::trans_affine& m)
+    {
+        product(t, t, m);
+    }
+
+    // Same as t.premultiply(m)
+    inline void
+    premultiply(agg::trans_affine& t, const agg::trans_affine& m)
+    {
+        product(t, m, t);
+    }
+}
+
+#undef SIMDAFFINE_SSE2
+#undef SIMDAFFINE_MADD
+#undef SIMDAFFINE_MADD256
+
+#endif // INCLUDE_SIMDAFFINE_H
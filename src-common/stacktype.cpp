@@ -72,11 +72,70 @@ int StackRule::ParamUID = 0;
 int StackRule::ParamOfInterest = 3;
 #endif
 
+namespace {
+    // Parameter blocks are allocated and freed for nearly every shape that a
+    // rule expands to, and most of them only live until the child shape is
+    // expanded or drawn. Freed blocks are kept on per-thread free lists by
+    // size and reused instead of going back to the heap. Each block is a
+    // separate heap allocation, so a block can be freed on a different
+    // thread than the one that allocated it.
+    class BlockCache {
+    public:
+        enum { MaxBlockSize = 64, MaxFreeBlocks = 1024 };
+        
+        StackType* get(size_t n)
+        {
+            if (n <= MaxBlockSize && mFree[n]) {
+                StackType* block = mFree[n];
+                mFree[n] = *reinterpret_cast<StackType**>(block);
+                --mCount[n];
+                return block;
+            }
+            return static_cast<StackType*>(::operator new(n * sizeof(StackType)));
+        }
+        
+        void put(const StackType* data, size_t n)
+        {
+            StackType* block = const_cast<StackType*>(data);
+            if (n <= MaxBlockSize && mCount[n] < MaxFreeBlocks) {
+                *reinterpret_cast<StackType**>(block) = mFree[n];
+                mFree[n] = block;
+                ++mCount[n];
+            } else {
+                ::operator delete(block);
+            }
+        }
+        
+        ~BlockCache()
+        {
+            for (StackType* block: mFree)
+                while (block) {
+                    StackType* next = *reinterpret_cast<StackType**>(block);
+                    ::operator delete(block);
+                    block = next;
+                }
+        }
+        
+    private:
+        StackType*  mFree[MaxBlockSize + 1] = {};
+        unsigned    mCount[MaxBlockSize + 1] = {};
+    };
+    
+    thread_local BlockCache FreeBlocks;
+    
+    // A block with no parameters is just the rule header
+    inline size_t
+    blockSize(size_t paramCount)
+    {
+        return paramCount ? paramCount + StackRule::HeaderSize : 1;
+    }
+}
+
 StackRule*
 StackRule::alloc(int name, int size, const AST::ASTparameters* ti)
 {
     ++Renderer::ParamCount;
-    StackType* newrule = size ? new StackType[size + HeaderSize] : new StackType;
+    StackType* newrule = FreeBlocks.get(blockSize(size));
     assert((reinterpret_cast<intptr_t>(newrule) & 3) == 0);   // confirm 32-bit alignment
     newrule[0].ruleHeader.mRuleName = static_cast<int16_t>(name);
     newrule[0].ruleHeader.mRefCount = 0;
@@ -156,12 +215,38 @@ StackRule::release() const noexcept
         (*f).second = -n;
 #endif
         --Renderer::ParamCount;
-        if (mParamCount)
-            delete[] data;
-        else
-            delete data;
+        FreeBlocks.put(data, blockSize(mParamCount));
+        return;
+    }
+}
+
+void
+StackRule::makePermanent(std::vector<const StackRule*>& owner) const
+{
+    if (mRefCount == MaxRefCount)
         return;
+    mRefCount = MaxRefCount;
+    owner.push_back(this);
+    for (const_iterator it = begin(), e = end(); it != e; ++it)
+        if (it.type().mType == AST::RuleType && it->rule)
+            it->rule->makePermanent(owner);
+}
+
+// Free permanent parameter blocks. Any parameter blocks that they refer to are
+// also permanent and in the list, so there is no need to destroy the contents.
+void
+StackRule::ReleasePermanent(std::vector<const StackRule*>& owner)
+{
+    for (const StackRule* p: owner) {
+#ifdef EXTREME_PARAM_DEBUG
+        auto f = ParamMap.find(p);
+        if (f != ParamMap.end())
+            (*f).second = -(*f).second;
+#endif
+        --Renderer::ParamCount;
+        ::operator delete(const_cast<StackRule*>(p));
     }
+    owner.clear();
 }
 
 // Release arguments on the stack
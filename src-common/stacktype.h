@@ -168,6 +168,11 @@ public:
     friend class param_ptr;     // only param_ptr can change the refcount
     void        copyParams(StackType* dest) const;
     
+    // Permanent parameter blocks are owned by the AST and shared by all of
+    // the renderers of a design. Their reference count is never changed.
+    void        makePermanent(std::vector<const StackRule*>& owner) const;
+    static void ReleasePermanent(std::vector<const StackRule*>& owner);
+    
     
     static param_ptr   Read(std::istream& is);
     static void        Write(std::ostream& os, const StackRule* s);
@@ -78,10 +78,11 @@ tiledCanvas::checkTile(const Bounds& b, const agg::rect_d& canvas, double dx, do
     return hit;
 }
 
-void
-tiledCanvas::tileTransform(const Bounds& b)
+bool
+tiledCanvas::tileTransform(const Bounds& b, bool cullCenter)
 // Compute a list of tiling offsets for all tiled copies of the shape that overlap
-// the canvas. Used for subsequent drawing.
+// the canvas. Used for subsequent drawing. Returns false if there are none. The
+// center copy is always in the list unless cullCenter is set.
 {
     double centx = (b.mMin_X + b.mMax_X) * 0.5;
     double centy = (b.mMin_Y + b.mMax_Y) * 0.5;
@@ -90,10 +91,14 @@ tiledCanvas::tileTransform(const Bounds& b)
     centy = floor(centy + 0.5);                 // round to nearest integer
 
     mTileList.clear();
-    double dx = -centx, dy = -centy;
-    mOffset.transform(&dx, &dy);
-    mTileList.emplace_back(dx, dy);
     agg::rect_d canvas(-5, -5, static_cast<double>(mWidth + 9), static_cast<double>(mHeight + 9));
+    if (cullCenter && b.valid()) {
+        checkTile(b, canvas, -centx, -centy);
+    } else {
+        double dx = -centx, dy = -centy;
+        mOffset.transform(&dx, &dy);
+        mTileList.emplace_back(dx, dy);
+    }
     
     if (mFrieze)
         centx = centy = centx + centy;      // one will be zero, set them both to the other one
@@ -113,7 +118,7 @@ tiledCanvas::tileTransform(const Bounds& b)
             }
         }
         
-        if (!hit) return;
+        if (!hit) return !mTileList.empty();
     }
 }
 
@@ -50,7 +50,7 @@ public:
     void scale(double scaleFactor);
     
     tileList getTessellation(int width, int height, int x, int y, bool flipY = false);
-    void tileTransform(const Bounds& b);
+    bool tileTransform(const Bounds& b, bool cullCenter = true);
     
 private:
     Canvas* mTile;
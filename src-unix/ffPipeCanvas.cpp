@@ -0,0 +1,390 @@
+// ffPipeCanvas.cpp
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+
+#include "ffPipeCanvas.h"
+#include "makeCFfilename.h"
+#include "variation.h"
+#include "agg_color_rgba.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+namespace {
+    aggCanvas::PixelFormat
+    mapPixFmt(aggCanvas::PixelFormat in)
+    {
+        switch (in) {
+            case aggCanvas::Gray8_Blend:
+            case aggCanvas::Gray16_Blend:
+                return aggCanvas::Gray8_Blend;
+            case aggCanvas::RGB8_Blend:
+            case aggCanvas::RGB16_Blend:
+                return aggCanvas::RGB8_Blend;
+            default:
+                return aggCanvas::RGBA8_Blend;
+        }
+    }
+
+    // Turns an output file name template into an ffmpeg image2 file name
+    // pattern, which has %d instead of %f for the frame number
+    string
+    imagePattern(const char* fmt, int frameCount, int variation)
+    {
+        int numLength = 0;
+        for (int c = frameCount; c > 0; c /= 10)
+            ++numLength;
+
+        string pattern;
+        for (const char* p = fmt; *p; ++p) {
+            if (*p != '%' || !p[1]) {
+                pattern.push_back(*p);
+                continue;
+            }
+            switch (*++p) {
+                case 'V':
+                case 'v':
+                    pattern.append(Variation::toString(variation, *p == 'v'));
+                    break;
+                case 'f':
+                    pattern.append("%0").append(to_string(numLength)).push_back('d');
+                    break;
+                case '%':
+                    pattern.append("%%");
+                    break;
+                default:
+                    pattern.append("%%").push_back(*p);
+                    break;
+            }
+        }
+        return pattern;
+    }
+}
+
+class ffPipeCanvas::Impl
+{
+public:
+    using frame_ptr = unique_ptr<unsigned char[]>;
+
+    Impl(const vector<string>& args, PixelFormat fmt, size_t frameSize,
+         int width, unsigned queueLength);
+    ~Impl();
+
+    bool addFrame(const unsigned char* bits);
+    bool finish();
+
+    PixelFormat     mPixelFormat;
+    size_t          mFrameSize;
+    int             mWidth;
+    unsigned        mQueueLength;
+    unsigned        mAllocated;
+    const char*     mError;
+
+    pid_t           mPid;
+    int             mPipe;
+
+    mutex           mMutex;
+    condition_variable mReady;     // a frame was queued or we are done
+    condition_variable mSpace;     // a frame buffer was freed
+    deque<frame_ptr> mQueue;
+    vector<frame_ptr> mFree;
+    bool            mDone;
+    thread          mWriter;
+
+    void writer();
+    bool writeFrame(const unsigned char* bits, vector<unsigned char>& row);
+};
+
+ffPipeCanvas::Impl::Impl(const vector<string>& args, PixelFormat fmt, size_t frameSize,
+                         int width, unsigned queueLength)
+: mPixelFormat(fmt), mFrameSize(frameSize), mWidth(width),
+  mQueueLength(queueLength ? queueLength : 1), mAllocated(0), mError(nullptr),
+  mPid(-1), mPipe(-1), mDone(false)
+{
+    int fds[2];
+    if (::pipe(fds) < 0) {
+        mError = "couldn't create pipe";
+        return;
+    }
+    ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);   // only the child reads it
+
+    vector<char*> argv;
+    for (const string& arg: args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    mPid = ::fork();
+    if (mPid == 0) {
+        ::dup2(fds[0], 0);
+        ::close(fds[0]);
+        ::execvp(argv[0], argv.data());
+        ::_exit(127);
+    }
+    ::close(fds[0]);
+    if (mPid < 0) {
+        ::close(fds[1]);
+        mError = "couldn't start ffmpeg";
+        return;
+    }
+    mPipe = fds[1];
+    mWriter = thread(&Impl::writer, this);
+}
+
+ffPipeCanvas::Impl::~Impl()
+{
+    finish();
+}
+
+bool
+ffPipeCanvas::Impl::addFrame(const unsigned char* bits)
+{
+    frame_ptr frame;
+    {
+        unique_lock<mutex> lock(mMutex);
+        mSpace.wait(lock, [this]() {
+            return mError || !mFree.empty() || mAllocated < mQueueLength;
+        });
+        if (mError)
+            return false;
+        if (mFree.empty()) {
+            ++mAllocated;
+        } else {
+            frame = std::move(mFree.back());
+            mFree.pop_back();
+        }
+    }
+    if (!frame)
+        frame = make_unique<unsigned char[]>(mFrameSize);
+    memcpy(frame.get(), bits, mFrameSize);
+
+    lock_guard<mutex> lock(mMutex);
+    mQueue.push_back(std::move(frame));
+    mReady.notify_one();
+    return true;
+}
+
+void
+ffPipeCanvas::Impl::writer()
+{
+    // A dead ffmpeg should show up as a write error, not kill us
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &blocked, nullptr);
+
+    vector<unsigned char> row;
+    for (;;) {
+        frame_ptr frame;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mReady.wait(lock, [this]() { return mDone || !mQueue.empty(); });
+            if (mQueue.empty())
+                return;
+            frame = std::move(mQueue.front());
+            mQueue.pop_front();
+        }
+        bool ok = writeFrame(frame.get(), row);
+
+        lock_guard<mutex> lock(mMutex);
+        if (!ok && !mError)
+            mError = "couldn't send frame to ffmpeg";
+        mFree.push_back(std::move(frame));
+        mSpace.notify_one();
+    }
+}
+
+bool
+ffPipeCanvas::Impl::writeFrame(const unsigned char* bits, vector<unsigned char>& row)
+{
+    auto writeAll = [this](const unsigned char* data, size_t length) {
+        while (length) {
+            ssize_t n = ::write(mPipe, data, length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    };
+
+    if (mPixelFormat != aggCanvas::RGBA8_Blend)
+        return writeAll(bits, mFrameSize);
+
+    // ffmpeg expects non-premultiplied alpha
+    size_t stride = static_cast<size_t>(mWidth) * 4;
+    row.resize(stride);
+    for (size_t r = 0; r < mFrameSize; r += stride) {
+        const unsigned char* src = bits + r;
+        for (size_t c = 0; c < stride; c += 4) {
+            agg::rgba8 pix(src[c + 0], src[c + 1], src[c + 2], src[c + 3]);
+            pix.demultiply();
+            row[c + 0] = pix.r;
+            row[c + 1] = pix.g;
+            row[c + 2] = pix.b;
+            row[c + 3] = pix.a;
+        }
+        if (!writeAll(row.data(), stride))
+            return false;
+    }
+    return true;
+}
+
+bool
+ffPipeCanvas::Impl::finish()
+{
+    if (mWriter.joinable()) {
+        {
+            lock_guard<mutex> lock(mMutex);
+            mDone = true;
+            mReady.notify_one();
+        }
+        mWriter.join();
+    }
+    if (mPipe >= 0) {
+        ::close(mPipe);
+        mPipe = -1;
+    }
+    if (mPid > 0) {
+        int status;
+        while (::waitpid(mPid, &status, 0) < 0 && errno == EINTR) { }
+        mPid = -1;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+            mError = "couldn't run ffmpeg";
+        else if (WEXITSTATUS(status) != 0)
+            mError = "ffmpeg failed";
+    }
+    return !mError;
+}
+
+bool
+ffPipeCanvas::CodecFromName(const char* name, Codec& codec)
+{
+    if (strcmp(name, "h264") == 0)
+        codec = H264;
+    else if (strcmp(name, "vp9") == 0)
+        codec = VP9;
+    else if (strcmp(name, "png") == 0)
+        codec = PNGsequence;
+    else
+        return false;
+    return true;
+}
+
+ffPipeCanvas::ffPipeCanvas(const char* name, PixelFormat fmt, int width, int height,
+                           int fps, int frameCount, int variation, Codec codec,
+                           unsigned queueLength)
+: aggCanvas(mapPixFmt(fmt)), mErrorMsg(nullptr)
+{
+    fmt = mapPixFmt(fmt);
+    if (codec != PNGsequence) {
+        // 4:2:0 chroma subsampling needs even dimensions
+        width &= ~1;
+        height &= ~1;
+    }
+    int stride = width * aggCanvas::BytesPerPixel.at(fmt);
+    size_t frameSize = static_cast<size_t>(stride) * height;
+    mBits = make_unique<unsigned char[]>(frameSize);
+    aggCanvas::attach(mBits.get(), width, height, stride);
+
+    bool toStdout = strcmp(name, "-") == 0;
+    bool alpha = fmt == aggCanvas::RGBA8_Blend;
+    vector<string> args = {
+        "ffmpeg", "-hide_banner", "-loglevel", "error", "-y",
+        "-f", "rawvideo",
+        "-pix_fmt", fmt == aggCanvas::Gray8_Blend ? "gray" : (alpha ? "rgba" : "rgb24"),
+        "-s", to_string(width) + 'x' + to_string(height),
+        "-framerate", to_string(fps),
+        "-i", "pipe:0"
+    };
+    string output;
+    switch (codec) {
+        case H264:
+            args.insert(args.end(), {"-c:v", "libx264", "-pix_fmt", "yuv420p"});
+            if (toStdout)
+                args.insert(args.end(), {"-f", "matroska"});
+            output = makeCFfilename(name, 0, 0, variation);
+            break;
+        case VP9:
+            args.insert(args.end(), {"-c:v", "libvpx-vp9",
+                                     "-pix_fmt", alpha ? "yuva420p" : "yuv420p"});
+            if (toStdout)
+                args.insert(args.end(), {"-f", "webm"});
+            output = makeCFfilename(name, 0, 0, variation);
+            break;
+        case PNGsequence:
+            args.insert(args.end(), {"-c:v", "png"});
+            if (toStdout) {
+                args.insert(args.end(), {"-f", "image2pipe"});
+            } else {
+                args.insert(args.end(), {"-f", "image2", "-start_number", "0"});
+                output = imagePattern(name, frameCount, variation);
+            }
+            break;
+    }
+    args.push_back(toStdout ? string("pipe:1") : output);
+
+    impl = make_unique<Impl>(args, fmt, frameSize, width, queueLength);
+    if (impl->mError) {
+        mErrorMsg = impl->mError;
+        impl.reset();
+        mError = true;
+    }
+}
+
+ffPipeCanvas::~ffPipeCanvas() = default;
+
+void
+ffPipeCanvas::end()
+{
+    aggCanvas::end();
+
+    if (impl && !impl->addFrame(mBits.get())) {
+        mErrorMsg = impl->mError;
+        mError = true;
+    }
+}
+
+bool
+ffPipeCanvas::finish()
+{
+    if (impl && !impl->finish()) {
+        mErrorMsg = impl->mError;
+        mError = true;
+    }
+    impl.reset();
+    return !mErrorMsg;
+}
@@ -0,0 +1,62 @@
+// ffPipeCanvas.h
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+
+#ifndef INCLUDE_FFPIPECANVAS_H
+#define INCLUDE_FFPIPECANVAS_H
+
+#include "aggCanvas.h"
+#include <memory>
+
+// Animation canvas that streams raw frames to an ffmpeg process over a pipe.
+// Each frame is copied into a bounded queue when it is finished and a writer
+// thread feeds the queue to ffmpeg, so encoding one frame overlaps with
+// rendering the next. end() only waits when the queue is full.
+
+class ffPipeCanvas : public aggCanvas {
+public:
+    enum Codec { H264 = 0, VP9 = 1, PNGsequence = 2 };
+    static bool CodecFromName(const char* name, Codec& codec);
+
+    // name is an output file name template as for pngCanvas, "-" is stdout
+    ffPipeCanvas(const char* name, PixelFormat fmt, int width, int height,
+                 int fps, int frameCount, int variation, Codec codec,
+                 unsigned queueLength = 4);
+    ~ffPipeCanvas() override;
+    ffPipeCanvas& operator=(const ffPipeCanvas& c) = delete;
+
+    const char* mErrorMsg;
+
+    void end() override;
+    bool finish();
+        // sends the queued frames and waits for ffmpeg to exit, returns
+        // false and sets mErrorMsg if anything failed
+
+private:
+    std::unique_ptr<unsigned char[]> mBits;
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+#endif // INCLUDE_FFPIPECANVAS_H
@@ -0,0 +1,465 @@
+// libcfdg.cpp
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+#include "libcfdg.h"
+#include "cfdg.h"
+#include "commandLineSystem.h"
+#include "aggCanvas.h"
+#include "pngCanvas.h"
+#include "SVGCanvas.h"
+#include "tiledCanvas.h"
+#include "variation.h"
+#include <sstream>
+#include <mutex>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace {
+    // The parser keeps its state in statics
+    mutex ParseMutex;
+
+    thread_local string LastError;
+
+    // Reads the design text from memory and collects messages for the
+    // calling thread instead of writing them to the console.
+    class LibrarySystem : public CommandLineSystem {
+    public:
+        LibrarySystem(const string& name, const string& text, const char* root)
+        : CommandLineSystem(true), mName(name), mText(text), mConfined(root != nullptr)
+        {
+            char resolved[PATH_MAX];
+            if (root && *root && ::realpath(root, resolved)) {
+                mRoot = resolved;
+                if (mRoot.back() != '/')
+                    mRoot.push_back('/');
+            }
+        }
+
+        void message(const char* fmt, ...) override
+        {
+            char buf[256];
+            va_list args;
+            va_start(args, fmt);
+            vsnprintf(buf, sizeof(buf), fmt, args);
+            va_end(args);
+
+            if (!Messages.empty())
+                Messages.append("; ");
+            Messages.append(buf);
+        }
+
+        void stats(const Stats&) override { }
+
+        istream* openFileForRead(const string& path) override
+        {
+            if (path == mName)
+                return new istringstream(mText);
+            if (mConfined && !insideRoot(path))
+                return nullptr;
+            return CommandLineSystem::openFileForRead(path);
+        }
+
+        bool fileStamp(const string& path, FileStamp& stamp) override
+        {
+            // The cfdg text never changes; files outside the root are not
+            // stamped, and can't be opened either
+            if (path == mName) {
+                stamp = FileStamp{mText.length(), 0};
+                return true;
+            }
+            if (mConfined && !insideRoot(path))
+                return false;
+            return CommandLineSystem::fileStamp(path, stamp);
+        }
+
+        static string takeMessages(const char* fallback)
+        {
+            string ret;
+            ret.swap(Messages);
+            if (ret.empty())
+                ret = fallback;
+            return ret;
+        }
+
+    private:
+        const string& mName;
+        const string& mText;
+        bool mConfined;
+        string mRoot;       // with a trailing slash, empty if no files
+        static thread_local string Messages;
+
+        bool insideRoot(const string& path) const
+        {
+            char resolved[PATH_MAX];
+            return !mRoot.empty() && ::realpath(path.c_str(), resolved) &&
+                   strncmp(resolved, mRoot.c_str(), mRoot.length()) == 0;
+        }
+    };
+
+    thread_local string LibrarySystem::Messages;
+
+    // Draws into the caller's pixels. Sized and tiled designs can come out
+    // smaller than the buffer, so the image is centered and tiled designs are
+    // repeated to fill the buffer, like a multiplied PNG.
+    class rgbaCanvas : public aggCanvas {
+    public:
+        rgbaCanvas(void* pixels, int width, int height, int stride, Renderer* r)
+        : aggCanvas(RGBA8_Blend), mData(static_cast<unsigned char*>(pixels)),
+          mStride(stride), mFullWidth(width), mFullHeight(height), mRenderer(r)
+        {
+            for (int y = 0; y < height; ++y)
+                memset(mData + y * stride, 0, width * 4);
+            mOriginX = (width - r->m_width) / 2;
+            mOriginY = (height - r->m_height) / 2;
+            attach(mData + mOriginY * stride + mOriginX * 4, r->m_width,
+                   r->m_height, stride);
+        }
+
+        void end() override
+        {
+            aggCanvas::end();
+            if (!mRenderer->m_tiledCanvas) return;
+
+            tileList points = mRenderer->m_tiledCanvas->getTessellation(mFullWidth,
+                                        mFullHeight, mOriginX, mOriginY, true);
+            std::reverse(points.begin(), points.end());
+            for (auto&& pt: points) {
+                if (pt.x == mOriginX && pt.y == mOriginY) continue;
+                int x0 = std::max(pt.x, 0);
+                int x1 = std::min(pt.x + mWidth, mFullWidth);
+                if (x0 >= x1) continue;
+                for (int y = 0; y < mHeight; ++y) {
+                    int desty = pt.y + y;
+                    if (desty < 0 || desty >= mFullHeight) continue;
+                    memmove(mData + desty * mStride + x0 * 4,
+                            mData + (mOriginY + y) * mStride + (mOriginX + x0 - pt.x) * 4,
+                            (x1 - x0) * 4);
+                }
+            }
+        }
+
+    private:
+        unsigned char* mData;
+        int mStride;
+        int mFullWidth;
+        int mFullHeight;
+        int mOriginX;
+        int mOriginY;
+        Renderer* mRenderer;
+    };
+
+    int
+    returnBuffer(const string& bytes, unsigned char** data, size_t* length)
+    {
+        *data = static_cast<unsigned char*>(malloc(bytes.length() ? bytes.length() : 1));
+        if (!*data) {
+            LastError = "Out of memory";
+            return 1;
+        }
+        memcpy(*data, bytes.data(), bytes.length());
+        *length = bytes.length();
+        return 0;
+    }
+}
+
+namespace libcfdg {
+    struct Design::impl {
+        string      mName;
+        string      mText;
+        int         mVariation;
+        // The system refers to mName and mText and must outlive the designs
+        unique_ptr<LibrarySystem> mSystem;
+        cfdg_ptr    mCFDG;
+
+        cfdg_ptr parse(int variation);
+        cfdg_ptr designFor(int variation);
+        unique_ptr<Renderer> run(const RenderOptions& opts, const cfdg_ptr& design,
+                                 int width, int height);
+    };
+
+    cfdg_ptr
+    Design::impl::parse(int variation)
+    {
+        cfdg_ptr design;
+        {
+            lock_guard<mutex> lock(ParseMutex);
+            design = CFDG::ParseFile(mName.c_str(), mSystem.get(), variation);
+        }
+        if (!design)
+            throw Error(LibrarySystem::takeMessages("Failed to parse cfdg file"));
+        LibrarySystem::takeMessages("");     // discard parse messages
+        return design;
+    }
+
+    cfdg_ptr
+    Design::impl::designFor(int variation)
+    {
+        if (mCFDG->usesStaticRandom && variation != mVariation)
+            return parse(variation);
+        return mCFDG;
+    }
+
+    unique_ptr<Renderer>
+    Design::impl::run(const RenderOptions& opts, const cfdg_ptr& design,
+                      int width, int height)
+    {
+        if (width < 10 || height < 10)
+            throw Error("Minimum output dimensions are 10 pixels");
+        if (opts.border < -1.0 || opts.border > 2.0)
+            throw Error("Border size must be between -1 and 2");
+        if (opts.variation < 1)
+            throw Error("Invalid variation");
+        LibrarySystem::takeMessages("");     // discard messages from earlier renders
+
+        unique_ptr<Renderer> renderer(design->renderer(design, width, height,
+                                      opts.minSize, opts.variation, opts.border));
+        if (!renderer)
+            throw Error(LibrarySystem::takeMessages("Failed to create renderer"));
+        if (opts.maxShapes > 0)
+            renderer->setMaxShapes(opts.maxShapes);
+        renderer->setLegacyOrder(opts.legacyOrder);
+        renderer->setCulling(opts.cull);
+        renderer->setSplitSeeds(opts.splitSeeds);
+        renderer->run(nullptr, false);
+        if (renderer->requestStop)
+            throw Error(LibrarySystem::takeMessages("Render failed"));
+        return renderer;
+    }
+
+    Design::Design(const string& text, int variation, const string& name,
+                   const char* root)
+    : m(make_unique<impl>())
+    {
+        m->mName = name.empty() ? string("design.cfdg") : name;
+        m->mText = text;
+        m->mVariation = variation;
+        m->mSystem = make_unique<LibrarySystem>(m->mName, m->mText, root);
+        m->mCFDG = m->parse(variation);
+    }
+
+    Design::~Design() = default;
+
+    bool
+    Design::usesStaticRandom() const
+    {
+        return m->mCFDG->usesStaticRandom;
+    }
+
+    bool
+    Design::sourcesChanged() const
+    {
+        return m->mCFDG->sourcesChanged();
+    }
+
+    void
+    Design::renderRGBA(const RenderOptions& opts, void* pixels,
+                       int width, int height, int stride)
+    {
+        if (!pixels || stride < width * 4)
+            throw Error("Invalid pixel buffer");
+        cfdg_ptr design = m->designFor(opts.variation);
+        unique_ptr<Renderer> renderer = m->run(opts, design, width, height);
+        rgbaCanvas canvas(pixels, width, height, stride, renderer.get());
+        renderer->draw(&canvas);
+    }
+
+    string
+    Design::renderPNG(const RenderOptions& opts)
+    {
+        cfdg_ptr design = m->designFor(opts.variation);
+        unique_ptr<Renderer> renderer = m->run(opts, design, opts.width, opts.height);
+
+        string image;
+        bool crop = opts.crop && !(design->isTiled() || design->isFrieze());
+        pngCanvas png("", true, renderer->m_width, renderer->m_height,
+                      aggCanvas::SuggestPixelFormat(design.get()), crop, 0,
+                      opts.variation, false, renderer.get(), 1, 1);
+        png.outputToMemory(&image);
+        if (png.mWidth != renderer->m_width || png.mHeight != renderer->m_height)
+            renderer->resetSize(png.mWidth, png.mHeight);
+        renderer->draw(&png);
+        if (image.empty())
+            throw Error("Failed to generate PNG output");
+        return image;
+    }
+
+    string
+    Design::renderSVG(const RenderOptions& opts)
+    {
+        cfdg_ptr design = m->designFor(opts.variation);
+        unique_ptr<Renderer> renderer = m->run(opts, design, opts.width, opts.height);
+
+        ostringstream out;
+        bool crop = opts.crop && !(design->isTiled() || design->isFrieze());
+        SVGCanvas svg(out, renderer->m_width, renderer->m_height, crop);
+        renderer->draw(&svg);
+        if (svg.mError)
+            throw Error("Failed to generate SVG output");
+        return out.str();
+    }
+}
+
+struct cfdg_design : public libcfdg::Design {
+    using libcfdg::Design::Design;
+};
+
+namespace {
+    libcfdg::RenderOptions
+    convertOptions(const cfdg_render_options* opts)
+    {
+        libcfdg::RenderOptions ret;
+        if (opts) {
+            ret.width = opts->width;
+            ret.height = opts->height;
+            ret.variation = opts->variation;
+            ret.minSize = opts->min_size;
+            ret.border = opts->border;
+            ret.maxShapes = opts->max_shapes;
+            ret.crop = opts->crop != 0;
+            ret.legacyOrder = opts->legacy_order != 0;
+            ret.cull = opts->cull != 0;
+            ret.splitSeeds = opts->split_seeds != 0;
+        }
+        return ret;
+    }
+
+    template <typename F>
+    int
+    catchErrors(F f)
+    {
+        try {
+            f();
+            return 0;
+        } catch (std::exception& e) {
+            LastError = e.what();
+        } catch (...) {
+            LastError = "Unknown error";
+        }
+        return 1;
+    }
+
+    template <typename D>
+    D&
+    checkDesign(D* design)
+    {
+        if (!design)
+            throw libcfdg::Error("No design");
+        return *design;
+    }
+}
+
+void
+cfdg_default_options(cfdg_render_options* opts)
+{
+    libcfdg::RenderOptions defaults;
+    opts->width = defaults.width;
+    opts->height = defaults.height;
+    opts->variation = defaults.variation;
+    opts->min_size = defaults.minSize;
+    opts->border = defaults.border;
+    opts->max_shapes = defaults.maxShapes;
+    opts->crop = defaults.crop;
+    opts->legacy_order = defaults.legacyOrder;
+    opts->cull = defaults.cull;
+    opts->split_seeds = defaults.splitSeeds;
+}
+
+int
+cfdg_variation_from_string(const char* code)
+{
+    return Variation::fromString(code);
+}
+
+cfdg_design*
+cfdg_parse(const char* text, size_t length, const char* name, int variation)
+{
+    cfdg_design* design = nullptr;
+    catchErrors([&]() {
+        design = new cfdg_design(string(text, length), variation,
+                                 name ? string(name) : string());
+    });
+    return design;
+}
+
+void
+cfdg_free_design(cfdg_design* design)
+{
+    delete design;
+}
+
+int
+cfdg_design_changed(const cfdg_design* design)
+{
+    bool changed = true;
+    catchErrors([&]() { changed = checkDesign(design).sourcesChanged(); });
+    return changed ? 1 : 0;
+}
+
+int
+cfdg_render_rgba(cfdg_design* design, const cfdg_render_options* opts,
+                 void* pixels, int width, int height, int stride)
+{
+    return catchErrors([&]() {
+        checkDesign(design).renderRGBA(convertOptions(opts), pixels, width, height, stride);
+    });
+}
+
+int
+cfdg_render_png(cfdg_design* design, const cfdg_render_options* opts,
+                unsigned char** data, size_t* length)
+{
+    string bytes;
+    if (catchErrors([&]() { bytes = checkDesign(design).renderPNG(convertOptions(opts)); }))
+        return 1;
+    return returnBuffer(bytes, data, length);
+}
+
+int
+cfdg_render_svg(cfdg_design* design, const cfdg_render_options* opts,
+                unsigned char** data, size_t* length)
+{
+    string bytes;
+    if (catchErrors([&]() { bytes = checkDesign(design).renderSVG(convertOptions(opts)); }))
+        return 1;
+    return returnBuffer(bytes, data, length);
+}
+
+void
+cfdg_free_buffer(unsigned char* data)
+{
+    free(data);
+}
+
+const char*
+cfdg_last_error(void)
+{
+    return LastError.c_str();
+}
@@ -0,0 +1,152 @@
+// libcfdg.h
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+#ifndef INCLUDE_LIBCFDG_H
+#define INCLUDE_LIBCFDG_H
+
+// In-memory interface to Context Free for programs that link with libcfdg.a.
+// Designs are parsed from strings and rendered either into a caller-provided
+// pixel buffer or into encoded PNG or SVG bytes; nothing touches the file
+// system except for import statements and temporary files for very large
+// renders.
+//
+// Parsing is serialized internally. A parsed design can be rendered by
+// several threads at once.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cfdg_design cfdg_design;
+
+typedef struct cfdg_render_options {
+    int     width;          // output size, ignored by cfdg_render_rgba
+    int     height;
+    int     variation;      // from cfdg_variation_from_string(), 1 is A
+    double  min_size;       // minimum shape size
+    double  border;         // border size [-1,2]
+    int     max_shapes;     // 0 for no limit
+    int     crop;           // crop PNG/SVG output to the design bounds
+    int     legacy_order;   // expand shapes in the order of earlier versions
+    int     cull;           // skip shapes that can't reach a sized canvas
+    int     split_seeds;    // derive child seeds from their index, not siblings
+} cfdg_render_options;
+
+// Fills in the defaults: 500x500, variation A, min size 0.3, border 2.
+void cfdg_default_options(cfdg_render_options* opts);
+
+// Returns a value less than 1 if the code is not a valid variation code.
+int cfdg_variation_from_string(const char* code);
+
+// Parses length bytes of cfdg text; name is used for error messages and to
+// resolve imports (may be null). Returns null on failure.
+cfdg_design* cfdg_parse(const char* text, size_t length, const char* name,
+                        int variation);
+void cfdg_free_design(cfdg_design* design);
+
+// Returns 1 if a file imported by the design has changed since it was
+// parsed, so the design should be parsed again. Also returns 1 if the
+// files can't be checked, with the reason in cfdg_last_error().
+int cfdg_design_changed(const cfdg_design* design);
+
+// Renders into width x height premultiplied RGBA pixels, 8 bits per channel,
+// with the first row at the top. Returns 0 on success.
+int cfdg_render_rgba(cfdg_design* design, const cfdg_render_options* opts,
+                     void* pixels, int width, int height, int stride);
+
+// Renders to encoded PNG or SVG bytes. The buffer returned in *data must be
+// released with cfdg_free_buffer(). Returns 0 on success.
+int cfdg_render_png(cfdg_design* design, const cfdg_render_options* opts,
+                    unsigned char** data, size_t* length);
+int cfdg_render_svg(cfdg_design* design, const cfdg_render_options* opts,
+                    unsigned char** data, size_t* length);
+void cfdg_free_buffer(unsigned char* data);
+
+// Message for the most recent failure on the calling thread.
+const char* cfdg_last_error(void);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+namespace libcfdg {
+    struct RenderOptions {
+        int     width = 500;
+        int     height = 500;
+        int     variation = 1;
+        double  minSize = 0.3;
+        double  border = 2.0;
+        int     maxShapes = 0;
+        bool    crop = false;
+        bool    legacyOrder = false;    // reproduces old output exactly
+        bool    cull = false;           // only affects sized designs
+        bool    splitSeeds = false;     // changes designs that use rand()
+    };
+
+    // Parse and render failures are reported with the messages that the
+    // command line program would have printed.
+    class Error : public std::runtime_error {
+    public:
+        explicit Error(const std::string& msg) : std::runtime_error(msg) { }
+    };
+
+    class Design {
+    public:
+        // If root is not null then the design can only import files inside
+        // the directory root, or no files at all if root is empty.
+        Design(const std::string& text, int variation = 1,
+               const std::string& name = std::string(),
+               const char* root = nullptr);
+        ~Design();
+
+        Design(const Design&) = delete;
+        Design& operator=(const Design&) = delete;
+
+        // rand_static() is evaluated by the parser, so these designs are
+        // parsed again when rendered with a different variation.
+        bool usesStaticRandom() const;
+
+        // True if an imported file is different from when the design was
+        // parsed. Each file is checked by a hash of its text.
+        bool sourcesChanged() const;
+
+        void renderRGBA(const RenderOptions& opts, void* pixels,
+                        int width, int height, int stride);
+        std::string renderPNG(const RenderOptions& opts);
+        std::string renderSVG(const RenderOptions& opts);
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> m;
+    };
+}
+
+#endif // __cplusplus
+
+#endif // INCLUDE_LIBCFDG_H
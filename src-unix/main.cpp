@@ -48,8 +48,16 @@
 #include "version.h"
 #include "Rand64.h"
 #include "makeCFfilename.h"
+#ifndef _WIN32
+#include "renderServer.h"
+#include "ffPipeCanvas.h"
+#endif
 #include <cassert>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 using std::string;
 using std::cerr;
@@ -63,9 +71,27 @@ const char* prettyInt(unsigned long);
 std::ostream* myCout = &cerr;
 
 static std::weak_ptr<Renderer> gRenderer;
+static bool gBatchMode = false;
+static std::atomic<bool> gStopBatch(false);
 
 static bool processInterrupt()
 {
+#ifndef _WIN32
+    if (RenderServer::CurrentServer) {
+        RenderServer::CurrentServer->stop();
+        cerr << endl << "Server interrupted, finishing the jobs in progress" << endl;
+        return true;
+    }
+#endif
+    
+    if (gBatchMode) {
+        if (gStopBatch)
+            exit(9);
+        gStopBatch = true;
+        cerr << endl << "Render interrupted, finishing the variations in progress" << endl;
+        return true;
+    }
+    
     auto TheRenderer = gRenderer.lock();
     if (!TheRenderer) return false;
     
@@ -99,31 +125,8 @@ void termination_handler(int signum)
 }
 #endif
 
-
-const char*
-prettyInt(unsigned long v)
-{
-    if (!v) return "0";
-    
-    static char temp[32];
-    temp[31] = '\0';
-    int i = 0;
-    char* pos = temp + 30;
-    for(;;) {
-        *pos = '0' + (v % 10);
-        v = v / 10;
-        if (!v) return pos;
-        ++i;
-        --pos;
-        if (i % 3 == 0) {
-            *pos = ',';
-            --pos;
-        }
-    }
-}
-
 struct options {
-    enum OutputFormat { PNGfile = 0, SVGfile = 1, MOVfile = 2, BMPfile = 3 };
+    enum OutputFormat { PNGfile = 0, SVGfile = 1, MOVfile = 2, BMPfile = 3, FFPIPEfile = 4 };
     int   width;
     int   height;
     int   widthMult;
@@ -133,12 +136,17 @@ struct options {
     double borderSize;
     
     int   variation;
+    std::vector<int> variations;
+    int   jobs;
+    std::string serve;
+    std::string serveRoot;
     bool  crop;
     bool  check;
     int   animationFrames;
     int   animationTime;
     int   animationFPS;
     bool  animationZoom;
+    std::string animationCodec;
     
     std::string input;
     std::string output;
@@ -150,14 +158,22 @@ struct options {
     bool outputWallpaper;
     bool paramTest;
     bool deleteTemps;
+    bool legacyOrder;
+    bool cull;
+    double lodArea;
+    int   pngLevel;
+    int   pngFilters;
+    int   pngThreads;
+    bool splitSeeds;
     
     options()
     : width(500), height(500), widthMult(1), heightMult(1), maxShapes(0), 
-      minSize(0.3F), borderSize(2.0F), variation(-1), crop(false), check(false), 
+      minSize(0.3F), borderSize(2.0F), variation(-1), jobs(0), crop(false), check(false), 
       animationFrames(0), animationTime(0), animationFPS(15), animationZoom(false), 
       format(PNGfile), quiet(false),
       outputTime(false), outputStdout(false), outputWallpaper(false),
-      paramTest(false), deleteTemps(false)
+      paramTest(false), deleteTemps(false), legacyOrder(false), cull(false), lodArea(0.0),
+      pngLevel(-1), pngFilters(-1), pngThreads(0), splitSeeds(false)
     { }
 };
 
@@ -189,6 +205,35 @@ intArg2(const std::string& arg, const std::string& sstr, int& x, int& y)
     return 2;
 }
 
+bool
+parseVariations(const std::string& arg, std::vector<int>& vars)
+{
+    // Either a range of variation codes (e.g., A..ZZ) or a file containing
+    // variation codes separated by white space
+    size_t dots = arg.find("..");
+    if (dots != string::npos) {
+        int first = Variation::fromString(arg.substr(0, dots).c_str());
+        int last = Variation::fromString(arg.substr(dots + 2).c_str());
+        if (first < 1 || last < first)
+            return false;
+        for (int v = first; v <= last; ++v)
+            vars.push_back(v);
+        return true;
+    }
+    
+    std::ifstream list(arg);
+    if (!list)
+        return false;
+    string code;
+    while (list >> code) {
+        int v = Variation::fromString(code.c_str());
+        if (v < 1)
+            return false;
+        vars.push_back(v);
+    }
+    return !vars.empty();
+}
+
 void
 processCommandLine(int argc, char* argv[], options& opt)
 {
@@ -226,6 +271,20 @@ processCommandLine(int argc, char* argv[], options& opt)
                                        {'b', "bordersize"}, 2.0);
     args::ValueFlag<string> variation(parser, "VARIATION",
         "Set the variation code (default is random)", {'v', "variation"}, "");
+    args::ValueFlag<string> variations(parser, "RANGE or FILE",
+        "Render a batch of variations, either a range of variation codes (e.g., "
+        "A..ZZ) or a file of variation codes. The cfdg file is only parsed once.",
+        {"variations"}, "");
+    args::ValueFlag<int> jobs(parser, "JOBS", "Number of variations to render at "
+        "once in batch or server mode (default is one per processor)", {'j', "jobs"}, 0);
+#ifndef _WIN32
+    args::ValueFlag<string> serve(parser, "unix:SOCKET",
+        "Run as a render server, accepting render jobs on the Unix domain "
+        "socket SOCKET", {"serve"}, "");
+    args::ValueFlag<string> serveRoot(parser, "DIR", "Directory of the cfdg files "
+        "that render jobs can render and import, without it jobs can't read "
+        "files", {"serve-root"}, "");
+#endif
     args::ValueFlag<string> outputFileTemplate(parser, "NAME TEMPLATE",
         "Set the output file name, supports variable expansion %f expands to the "
         "animation frame number, %v and %V expands to the variation code in lower "
@@ -237,6 +296,10 @@ processCommandLine(int argc, char* argv[], options& opt)
     args::Flag makeSVG(parser, "SVG", "Generate SVG output (not allowed for animation)",
                        {'V', "svg"});
     args::Flag makeQT(parser, "quicktime", "Make QuickTime output", {'Q', "quicktime"});
+#ifndef _WIN32
+    args::ValueFlag<string> ffmpeg(parser, "CODEC", "Stream the animation frames to "
+        "ffmpeg, CODEC is h264, vp9, or png (an image sequence)", {"ffmpeg"});
+#endif
 #ifdef _WIN32
     args::Flag wallpaper(parser, "wallpaper", "Generate desktop wallpaper output",
                          {'W', "wallpaper"});
@@ -250,6 +313,23 @@ processCommandLine(int argc, char* argv[], options& opt)
     args::Flag paramDebug(parser, "param debug", "Parameter allocation debug, test "
         "whether all the parameter blocks were cleaned up", {'P', "paramdebug"});
     args::Flag cleanup(parser, "cleanup", "Delete old temporary files", {'d', "cleanup"});
+    args::Flag legacyOrder(parser, "legacy order", "Expand shapes in the same order as "
+        "earlier versions, for reproducing old output exactly", {'L', "legacy-order"});
+    args::Flag cull(parser, "cull", "Skip shapes that cannot reach the canvas of a "
+        "sized design", {"cull"});
+    args::ValueFlag<double> lodArea(parser, "PIXELS", "Merge shapes smaller than "
+        "this many pixels into a coverage buffer (not for animations)", {"lod"});
+#ifndef _WIN32
+    args::ValueFlag<int> pngLevel(parser, "LEVEL", "PNG compression level, from 0 "
+        "(fastest) to 9 (smallest)", {"png-level"});
+    args::ValueFlag<string> pngFilter(parser, "FILTER", "PNG row filter: none, sub, "
+        "up, avg, paeth, or all (the default, the smallest files)", {"png-filter"});
+    args::ValueFlag<int> pngThreads(parser, "THREADS", "Number of threads that "
+        "compress a PNG image, 0 (the default) uses them for large images", {"png-threads"});
+#endif
+    args::ValueFlag<string> seedDerivation(parser, "DERIVATION", "How child shapes "
+        "get their random seeds: legacy (the default, reproduces earlier versions) or "
+        "split (a hash of the parent's seed and the child's index)", {"seeds"});
     args::Positional<std::string> inputFile(parser, "CFDG FILE", "Input cfdg file", "");
     args::Positional<std::string> outputFile(parser, "OUTPUT FILE", "Output image file", "");
     
@@ -288,6 +368,11 @@ processCommandLine(int argc, char* argv[], options& opt)
             bailout("Must specify at least one shape.");
     }
     if (minSize) opt.minSize = args::get(minSize);
+    if (lodArea) {
+        opt.lodArea = args::get(lodArea);
+        if (!(opt.lodArea >= 0.0 && opt.lodArea <= 16.0))
+            bailout("Level of detail area must be between 0 and 16 pixels");
+    }
     if (borderSize) {
         opt.borderSize = args::get(borderSize);
         if (opt.borderSize < -1.0 || opt.borderSize > 2.0)
@@ -298,11 +383,53 @@ processCommandLine(int argc, char* argv[], options& opt)
         if (opt.variation == -1)
             bailout("Error parsing variation");
     }
+    if (variations) {
+        if (variation)
+            bailout("Cannot specify a variation and a batch of variations.");
+        if (animation || wallpaper)
+            bailout("Batch variations cannot be animated or wallpaper.");
+        if (!parseVariations(args::get(variations), opt.variations))
+            bailout("Error parsing variation range or variation list file");
+        if (jobs) {
+            opt.jobs = args::get(jobs);
+            if (opt.jobs < 1)
+                bailout("Must specify at least one job.");
+        }
+    }
+#ifndef _WIN32
+    if (serve) {
+        opt.serve = args::get(serve);
+        if (opt.serve.compare(0, 5, "unix:") || opt.serve.length() == 5)
+            bailout("The server socket must be specified as unix:/path/to/socket");
+        opt.serve.erase(0, 5);
+        if (inputFile || outputFile || variations || animation || check)
+            bailout("The server takes its input and output from render jobs.");
+        if (jobs) {
+            opt.jobs = args::get(jobs);
+            if (opt.jobs < 1)
+                bailout("Must specify at least one job.");
+        }
+        opt.serveRoot = args::get(serveRoot);
+    } else if (serveRoot) {
+        bailout("The root directory is only for server mode.");
+    }
+#endif
     if (outputFileTemplate) opt.output = args::get(outputFileTemplate);
     if (animation) {
         if (makeSVG) bailout("Animation cannot output to SVG files.");
         if (crop) bailout("Animation cannot output cropped files.");
         if (makeQT) opt.format = options::MOVfile;
+#ifndef _WIN32
+        if (ffmpeg) {
+            ffPipeCanvas::Codec codec;
+            if (makeQT)
+                bailout("Cannot make QuickTime output and stream to ffmpeg.");
+            if (!ffPipeCanvas::CodecFromName(args::get(ffmpeg).c_str(), codec))
+                bailout("The ffmpeg codec must be h264, vp9, or png.");
+            opt.format = options::FFPIPEfile;
+            opt.animationCodec = args::get(ffmpeg);
+        }
+#endif
         opt.animationZoom = zoom;
         int fps = 15, time = 0;
         switch (intArg2(parser.ShortPrefix() + 'a', args::get(animation), time, fps)) {
@@ -321,6 +448,10 @@ processCommandLine(int argc, char* argv[], options& opt)
     } else {
         if (makeQT)
             bailout("QuickTime output is only available when animating.");
+#ifndef _WIN32
+        if (ffmpeg)
+            bailout("ffmpeg output is only available when animating.");
+#endif
         if (zoom)
             bailout("Zoomed output is only available when animating.");
     }
@@ -337,6 +468,28 @@ processCommandLine(int argc, char* argv[], options& opt)
     opt.outputTime = timer;
     opt.paramTest = paramDebug;
     opt.deleteTemps = cleanup;
+    opt.legacyOrder = legacyOrder;
+    opt.cull = cull;
+#ifndef _WIN32
+    if (pngLevel) {
+        opt.pngLevel = args::get(pngLevel);
+        if (opt.pngLevel < 0 || opt.pngLevel > 9)
+            bailout("The PNG compression level must be between 0 and 9.");
+    }
+    if (pngFilter && !pngCanvas::FiltersFromName(args::get(pngFilter).c_str(), opt.pngFilters))
+        bailout("The PNG filter must be none, sub, up, avg, paeth, or all.");
+    if (pngThreads) {
+        opt.pngThreads = args::get(pngThreads);
+        if (opt.pngThreads < 0 || opt.pngThreads > 64)
+            bailout("The number of PNG threads must be between 0 and 64.");
+    }
+#endif
+    if (seedDerivation) {
+        if (args::get(seedDerivation) == "split")
+            opt.splitSeeds = true;
+        else if (args::get(seedDerivation) != "legacy")
+            bailout("Seed derivation must be legacy or split.");
+    }
     if (quiet && cleanup)
         bailout("Cannot clean up temporary files quietly.");
     if (inputFile) opt.input = args::get(inputFile);
@@ -351,7 +504,9 @@ processCommandLine(int argc, char* argv[], options& opt)
         for (char c: args::get(outputFile)) {
             opt.output.append(c == '%' ? 2 : 1, c);
         }
-        if (opt.animationFrames && opt.format != options::MOVfile) {
+        if (opt.animationFrames && opt.format != options::MOVfile &&
+            (opt.format != options::FFPIPEfile || opt.animationCodec == "png"))
+        {
             size_t ext = opt.output.find_last_of('.');
             size_t dir = opt.output.find_last_of(APP_DIRCHAR());
             if (ext != string::npos && (dir == string::npos || ext > dir)) {
@@ -361,7 +516,25 @@ processCommandLine(int argc, char* argv[], options& opt)
             }
         }
     }
-    if (!inputFile && !cleanup)
+    if (!opt.variations.empty()) {
+        if ((!outputFile || opt.output == "-") && !outputFileTemplate)
+            bailout("Batch variations require an output file name or template.");
+        
+        // Each variation needs its own file, add "_%V" before the extension
+        // if the file name does not already vary.
+        if (makeCFfilename(opt.output.c_str(), 0, 0, 1) ==
+            makeCFfilename(opt.output.c_str(), 0, 0, 2))
+        {
+            size_t ext = opt.output.find_last_of('.');
+            size_t dir = opt.output.find_last_of(APP_DIRCHAR());
+            if (ext != string::npos && (dir == string::npos || ext > dir)) {
+                opt.output.insert(ext, "_%V");
+            } else {
+                opt.output.append("_%V");
+            }
+        }
+    }
+    if (!inputFile && !cleanup && opt.serve.empty())
         bailout("Missing input file.");
     if ((!outputFile || opt.output == "-") && !outputFileTemplate && !check) {
         opt.outputStdout = true;
@@ -383,6 +556,105 @@ public:
 
 static nullostream cnull;
 
+int
+renderBatch(const cfdg_ptr& design, const options& opts, AbstractSystem* system,
+            aggCanvas::PixelFormat pixfmt)
+{
+    // Renderers share the parsed design, which is read-only while rendering.
+    // Each worker thread takes the next variation until they are all done.
+    std::atomic<size_t> next(0);
+    std::atomic<int> failures(0);
+    std::mutex outputMutex;
+    std::mutex parseMutex;
+    bool crop = opts.crop && !(design->isTiled() || design->isFrieze());
+    
+    auto worker = [&]() {
+        for (size_t i = next++; i < opts.variations.size() && !gStopBatch; i = next++) {
+            int var = opts.variations[i];
+            unsigned paramCount = Renderer::ParamCount;
+            string name;
+            {   // Scope for design, canvas & renderer
+            cfdg_ptr varDesign = design;
+            if (design->usesStaticRandom) {
+                // rand_static() is evaluated by the parser, so the design
+                // must be parsed again for each variation
+                std::lock_guard<std::mutex> lock(parseMutex);
+                varDesign = CFDG::ParseFile(opts.input.c_str(), system, var);
+            }
+            if (!varDesign) {
+                ++failures;
+                continue;
+            }
+            std::unique_ptr<Renderer> renderer(varDesign->renderer(varDesign,
+                                                opts.width, opts.height, opts.minSize,
+                                                var, opts.borderSize));
+            if (!renderer) {
+                ++failures;
+                continue;
+            }
+            if (opts.maxShapes > 0)
+                renderer->setMaxShapes(opts.maxShapes);
+            renderer->setLegacyOrder(opts.legacyOrder);
+            renderer->setCulling(opts.cull);
+            renderer->setSplitSeeds(opts.splitSeeds);
+            renderer->setLevelOfDetail(opts.lodArea);
+            renderer->run(nullptr, false);
+            
+            std::unique_ptr<pngCanvas> png;
+            std::unique_ptr<SVGCanvas> svg;
+            Canvas* canvas = nullptr;
+            name = makeCFfilename(opts.output.c_str(), 0, 0, var);
+            if (opts.format == options::SVGfile) {
+                svg = std::make_unique<SVGCanvas>(name.c_str(), renderer->m_width,
+                                                  renderer->m_height, crop);
+                canvas = static_cast<Canvas*>(svg.get());
+            } else {
+                png = std::make_unique<pngCanvas>(opts.output.c_str(), true,
+                                                  renderer->m_width, renderer->m_height,
+                                                  pixfmt, crop, 0, var, false,
+                                                  renderer.get(), opts.widthMult,
+                                                  opts.heightMult);
+                png->setCompression(opts.pngLevel, opts.pngFilters);
+                png->setEncoderThreads(opts.pngThreads);
+                canvas = static_cast<Canvas*>(png.get());
+                if (png->mWidth != renderer->m_width || png->mHeight != renderer->m_height)
+                    renderer->resetSize(png->mWidth, png->mHeight);
+            }
+            if (canvas->mError || renderer->requestStop) {
+                ++failures;
+                continue;
+            }
+            renderer->draw(canvas);
+            }   // delete design, canvas & renderer
+            
+            std::lock_guard<std::mutex> lock(outputMutex);
+            if (opts.paramTest && Renderer::ParamCount != paramCount) {
+                cerr << "Left-over parameter blocks in memory for variation "
+                     << Variation::toString(var, false) << ": "
+                     << prettyInt(static_cast<unsigned long>(Renderer::ParamCount - paramCount)) << endl;
+                ++failures;
+            }
+            *myCout << "Variation " << Variation::toString(var, false)
+                    << " output to " << name << endl;
+        }
+    };
+    
+    unsigned jobs = opts.jobs > 0 ? static_cast<unsigned>(opts.jobs)
+                                  : std::thread::hardware_concurrency();
+    if (jobs == 0) jobs = 1;
+    if (jobs > opts.variations.size())
+        jobs = static_cast<unsigned>(opts.variations.size());
+    
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < jobs; ++i)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread& t: workers)
+        t.join();
+    
+    return failures ? 5 : 0;
+}
+
 int main (int argc, char* argv[]) {
     options opts;
     int var = Variation::random(6);
@@ -404,14 +676,31 @@ int main (int argc, char* argv[]) {
     
     if (opts.quiet) myCout = &cnull;
     
+#ifndef _WIN32
+    if (!opts.serve.empty()) {
+        unsigned jobs = opts.jobs > 0 ? static_cast<unsigned>(opts.jobs)
+                                      : std::thread::hardware_concurrency();
+        RenderServer server(opts.serve, opts.serveRoot, jobs);
+        RenderServer::CurrentServer = &server;
+        *myCout << "Serving render jobs on " << opts.serve << endl;
+        int ret = server.run();
+        RenderServer::CurrentServer = nullptr;
+        return ret;
+    }
+#endif
+    
     clock_t startTime = clock();
     clock_t fromTime = startTime;
     clock_t clocksPerMsec = CLOCKS_PER_SEC / 1000;
     
+    if (!opts.variations.empty()) opts.variation = opts.variations.front();
     if (opts.variation < 0) opts.variation = var;
     std::string code = Variation::toString(opts.variation, false);
     
-    CommandLineSystem system(opts.quiet);
+    gBatchMode = !opts.variations.empty();
+    
+    // Progress output from several renderers at once would be garbled
+    CommandLineSystem system(opts.quiet || gBatchMode);
     
     if (!opts.quiet || opts.deleteTemps) {
         std::vector<string> temps = system.findTempFiles();
@@ -455,7 +744,28 @@ int main (int argc, char* argv[]) {
     bool useRGBA = myDesign->usesColor;
     aggCanvas::PixelFormat pixfmt = aggCanvas::SuggestPixelFormat(myDesign.get());
     bool use16bit = (pixfmt & aggCanvas::Has_16bit_Color) != 0;
-    const char* fmtnames[4] = { "PNG image", "SVG vector output", "Quicktime movie", "Wallpaper BMP image" };
+    const char* fmtnames[5] = { "PNG image", "SVG vector output", "Quicktime movie",
+                                "Wallpaper BMP image", "ffmpeg video" };
+    
+    if (gBatchMode) {
+        *myCout << "Generating " << (use16bit ? "16bit " : "8bit ")
+            << (useRGBA ? "color" : "gray-scale")
+            << ' ' << fmtnames[opts.format] << ", "
+            << opts.variations.size() << " variations..." << endl;
+        int ret = renderBatch(myDesign, opts, &system, pixfmt);
+        if (opts.outputTime) {
+            clock_t runTime = (clock() - startTime) / clocksPerMsec;
+            *myCout << "The cfdg file took a total of " << prettyInt(runTime) << " msec to process." << endl;
+        }
+        if (opts.paramTest) {
+            myDesign.reset();   // Delete the AST and its parameters before checking
+            if (Renderer::ParamCount) {
+                cerr << "Left-over parameter blocks in memory:" << prettyInt(static_cast<unsigned long>(Renderer::ParamCount)) << endl;
+                return 88;
+            }
+        }
+        return ret;
+    }
     
     *myCout << "Generating " << (use16bit ? "16bit " : "8bit ") 
         << (useRGBA ? "color" : "gray-scale")
@@ -467,6 +777,9 @@ int main (int argc, char* argv[]) {
     std::unique_ptr<pngCanvas> png;
     std::unique_ptr<SVGCanvas> svg;
     std::unique_ptr<ffCanvas>  mov;
+#ifndef _WIN32
+    std::unique_ptr<ffPipeCanvas> ffpipe;
+#endif
     Canvas* myCanvas = nullptr;
         
     std::shared_ptr<Renderer> TheRenderer(myDesign->renderer(myDesign,
@@ -483,6 +796,11 @@ int main (int argc, char* argv[]) {
     
     if (opts.maxShapes > 0)
         TheRenderer->setMaxShapes(opts.maxShapes);
+    TheRenderer->setLegacyOrder(opts.legacyOrder);
+    TheRenderer->setCulling(opts.cull);
+    TheRenderer->setSplitSeeds(opts.splitSeeds);
+    // Splats don't keep the shape timing that animation needs
+    TheRenderer->setLevelOfDetail(opts.animationFrames ? 0.0 : opts.lodArea);
     TheRenderer->run(nullptr, false);
     
     opts.width = TheRenderer->m_width;
@@ -497,6 +815,8 @@ int main (int argc, char* argv[]) {
                                     pixfmt, opts.crop, opts.animationFrames, opts.variation,
                                     opts.format == options::BMPfile, TheRenderer.get(),
                                     opts.widthMult, opts.heightMult);
+            png->setCompression(opts.pngLevel, opts.pngFilters);
+            png->setEncoderThreads(opts.pngThreads);
             myCanvas = static_cast<Canvas*>(png.get());
             if (png->mWidth != opts.width || png->mHeight != opts.height) {
                 TheRenderer->resetSize(png->mWidth, png->mHeight);
@@ -524,6 +844,26 @@ int main (int argc, char* argv[]) {
             myCanvas = static_cast<Canvas*>(mov.get());
             break;
         }
+#ifndef _WIN32
+        case options::FFPIPEfile: {
+            ffPipeCanvas::Codec codec = ffPipeCanvas::H264;
+            ffPipeCanvas::CodecFromName(opts.animationCodec.c_str(), codec);
+            ffpipe = std::make_unique<ffPipeCanvas>(opts.output.c_str(), pixfmt,
+                                                  opts.width, opts.height, opts.animationFPS,
+                                                  opts.animationFrames, opts.variation, codec);
+            if (ffpipe->mErrorMsg) {
+                cerr << "Failed to start ffmpeg: " << ffpipe->mErrorMsg << endl;
+                exit(8);
+            }
+            myCanvas = static_cast<Canvas*>(ffpipe.get());
+            if (ffpipe->mWidth != opts.width || ffpipe->mHeight != opts.height) {
+                TheRenderer->resetSize(ffpipe->mWidth, ffpipe->mHeight);
+                opts.width = TheRenderer->m_width;
+                opts.height = TheRenderer->m_height;
+            }
+            break;
+        }
+#endif
     }
     
     if (myCanvas->mError || system.error(false) || TheRenderer->requestStop) {
@@ -545,6 +885,13 @@ int main (int argc, char* argv[]) {
         TheRenderer->draw(myCanvas);
     }
     *myCout << endl;
+#ifndef _WIN32
+    if (ffpipe && !ffpipe->finish()) {
+        cerr << "Failed to encode video: " << ffpipe->mErrorMsg << endl;
+        if (!opts.quiet) cleanupTimer();
+        return 8;
+    }
+#endif
     
     if (!opts.quiet) cleanupTimer();
     
@@ -28,8 +28,18 @@
 
 #include "pngCanvas.h"
 #include "png.h"
+#include "zlib.h"
 #include <stdlib.h>
 #include <iostream>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
 #include <arpa/inet.h>
 
 using namespace std;
@@ -47,11 +57,179 @@ namespace {
     {
         cerr << message << endl;
     }
+    
+    void
+    pngWriteMemory(png_structp png_ptr, png_bytep data, png_size_t length)
+    {
+        string* dest = static_cast<string*>(png_get_io_ptr(png_ptr));
+        dest->append(reinterpret_cast<const char*>(data), length);
+    }
+    
+    void
+    pngFlushMemory(png_structp png_ptr)
+    {
+    }
 }
 
 const char* prettyInt(unsigned long);
 
+// Encodes animation frames on a pool of threads so that the renderer can
+// start on the next frame right away. Each frame is copied into one of a
+// bounded number of buffers, add() waits when they are all in use.
+class pngCanvas::Encoder
+{
+public:
+    Encoder(pngCanvas* canvas, size_t frameSize)
+    : mCanvas(canvas), mFrameSize(frameSize), mAllocated(0), mDone(false)
+    {
+        unsigned threads = std::thread::hardware_concurrency();
+        threads = std::min(std::max(threads, 2u) - 1, 8u);   // one is rendering
+        mBufferLimit = 2 * threads;
+        for (unsigned i = 0; i < threads; ++i)
+            mThreads.emplace_back(&Encoder::worker, this);
+    }
+
+    ~Encoder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mDone = true;
+        }
+        mReady.notify_all();
+        for (std::thread& t: mThreads)
+            t.join();
+    }
+
+    void add(string&& name, int frame, const unsigned char* data,
+             size_t offset, int width, int height)
+    {
+        Frame f{std::move(name), frame, nullptr, offset, width, height};
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mSpace.wait(lock, [this]() {
+                return !mFree.empty() || mAllocated < mBufferLimit;
+            });
+            if (mFree.empty()) {
+                ++mAllocated;
+            } else {
+                f.mData = std::move(mFree.back());
+                mFree.pop_back();
+            }
+        }
+        if (!f.mData)
+            f.mData = std::make_unique<unsigned char[]>(mFrameSize);
+        memcpy(f.mData.get(), data, mFrameSize);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(std::move(f));
+        mReady.notify_one();
+    }
+
+private:
+    struct Frame {
+        string      mName;
+        int         mFrame;
+        std::unique_ptr<unsigned char[]> mData;
+        size_t      mOffset;
+        int         mWidth;
+        int         mHeight;
+    };
+
+    void worker()
+    {
+        for (;;) {
+            Frame f;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mReady.wait(lock, [this]() { return mDone || !mQueue.empty(); });
+                if (mQueue.empty())
+                    return;
+                f = std::move(mQueue.front());
+                mQueue.pop_front();
+            }
+            mCanvas->encode(f.mName.c_str(), f.mFrame, f.mData.get() + f.mOffset,
+                            f.mWidth, f.mHeight);
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            mFree.push_back(std::move(f.mData));
+            mSpace.notify_one();
+        }
+    }
+
+    pngCanvas*  mCanvas;
+    size_t      mFrameSize;
+    unsigned    mBufferLimit;
+    unsigned    mAllocated;
+    bool        mDone;
+    std::mutex  mMutex;
+    std::condition_variable mReady;     // a frame was queued or we are done
+    std::condition_variable mSpace;     // a frame buffer was freed
+    std::deque<Frame> mQueue;
+    std::vector<std::unique_ptr<unsigned char[]>> mFree;
+    std::vector<std::thread> mThreads;
+};
+
+pngCanvas::pngCanvas(const char* outfilename, bool quiet, int width, int height,
+                     PixelFormat pixfmt, bool crop, int frameCount, int variation,
+                     bool wallpaper, Renderer *r, int mx, int my)
+: abstractPngCanvas(outfilename, quiet, width, height, pixfmt, crop,
+                    frameCount, variation, wallpaper, r, mx, my),
+  mMemoryOutput(nullptr), mCompression(-1), mFilters(-1), mThreads(0)
+{
+}
+
+pngCanvas::~pngCanvas()
+{
+    mEncoder.reset();       // finish writing the frames
+}
+
+bool
+pngCanvas::FiltersFromName(const char* name, int& filters)
+{
+    static const std::pair<const char*, int> names[] = {
+        {"none",  PNG_FILTER_NONE},
+        {"sub",   PNG_FILTER_SUB},
+        {"up",    PNG_FILTER_UP},
+        {"avg",   PNG_FILTER_AVG},
+        {"paeth", PNG_FILTER_PAETH},
+        {"all",   PNG_ALL_FILTERS}
+    };
+    for (auto&& n: names) {
+        if (strcmp(name, n.first) == 0) {
+            filters = n.second;
+            return true;
+        }
+    }
+    return false;
+}
+
 void pngCanvas::output(const char* outfilename, int frame)
+{
+    int width = mFullWidth;
+    int height = mFullHeight;
+    int srcx = 0;
+    int srcy = 0;
+    if (mCrop) {
+        width = cropWidth();
+        height = cropHeight();
+        srcx = cropX();
+        srcy = cropY();
+    }
+    size_t offset = srcy * mStride + srcx * aggCanvas::BytesPerPixel.at(mPixelFormat);
+
+    // With one processor the copy would be pure overhead
+    static const bool async = std::thread::hardware_concurrency() > 1;
+    if (frame == -1 || mMemoryOutput || !async) {
+        encode(outfilename, frame, mData.get() + offset, width, height);
+    } else {
+        if (!mEncoder)
+            mEncoder = std::make_unique<Encoder>(this, static_cast<size_t>(mStride) * mFullHeight);
+        mEncoder->add(string(outfilename), frame, mData.get(), offset, width, height);
+    }
+}
+
+void pngCanvas::encode(const char* outfilename, int frame, const unsigned char* data,
+                       int width, int height)
 {
     unique_ptr<FILE, void(*)(FILE*)> out(nullptr, [](FILE* f)
     {   // f is not null
@@ -61,12 +239,7 @@ void pngCanvas::output(const char* outfilename, int frame)
     png_structp png_ptr = nullptr;
     png_infop info_ptr = nullptr;
 
-    std::unique_ptr<png_byte[]> row;
-    std::unique_ptr<png_uint_16[]> row16;
-    if (mPixelFormat & Has_16bit_Color)
-        row16 = std::make_unique<png_uint_16[]>(mStride);
-    else
-        row = std::make_unique<png_byte[]>(mStride);
+    std::unique_ptr<png_byte[]> row = std::make_unique<png_byte[]>(mStride);
     
     try {
         png_ptr = png_create_write_struct(
@@ -77,20 +250,25 @@ void pngCanvas::output(const char* outfilename, int frame)
         info_ptr = png_create_info_struct(png_ptr);
         if (!info_ptr) throw "couldn't create png info struct";
 
-        if (*outfilename) {
-            out.reset(fopen(outfilename, "wb"));
+        if (mMemoryOutput) {
+            mMemoryOutput->clear();
+            png_set_write_fn(png_ptr, mMemoryOutput, pngWriteMemory, pngFlushMemory);
         } else {
-            out.reset(stdout);
+            if (*outfilename) {
+                out.reset(fopen(outfilename, "wb"));
+            } else {
+                out.reset(stdout);
 #ifdef WIN32
-            setmode(fileno(stdout), O_BINARY);
+                setmode(fileno(stdout), O_BINARY);
 #endif
-        }
-        if (!out) {
-            cerr << "Couldn't open " << outfilename << "\n";
-            throw false;
-        }
+            }
+            if (!out) {
+                cerr << "Couldn't open " << outfilename << "\n";
+                throw false;
+            }
 
-        png_init_io(png_ptr, out.get());
+            png_init_io(png_ptr, out.get());
+        }
         
         int pngFormat;
         switch (mPixelFormat) {
@@ -110,27 +288,32 @@ void pngCanvas::output(const char* outfilename, int frame)
                 throw "Unknown pixel format";
         }
         
-        int width = mFullWidth;
-        int height = mFullHeight;
-        int srcx = 0;
-        int srcy = 0;
-        if (mCrop) {
-            width = cropWidth();
-            height = cropHeight();
-            srcx = cropX();
-            srcy = cropY();
-        }
-
         if (frame == -1 && !mQuiet) {
             cerr << endl << "Writing "
                  << prettyInt(static_cast<unsigned long>(width)) << "w x "
                  << prettyInt(static_cast<unsigned long>(height)) << "h pixel image..." << endl;
         } 
         
+        if (frame == -1 && !mMemoryOutput) {
+            unsigned threads = mThreads;
+            if (!threads && static_cast<double>(width) * height >= ParallelPixels)
+                threads = std::min(std::thread::hardware_concurrency(), 16u);
+            if (threads > 1) {
+                if (!writeParallel(out.get(), data, width, height, pngFormat, threads))
+                    throw "error writing png file";
+                png_destroy_write_struct(&png_ptr, &info_ptr);
+                return;
+            }
+        }
+
         png_set_IHDR(png_ptr, info_ptr,
             width, height, (mPixelFormat & Has_16bit_Color) + 8, pngFormat,
             PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
             PNG_FILTER_TYPE_DEFAULT);
+        if (mCompression >= 0)
+            png_set_compression_level(png_ptr, mCompression);
+        if (mFilters >= 0)
+            png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, mFilters);
 
         char myKey[] = "Software", myValue[] = "Context Free";
         
@@ -145,42 +328,9 @@ void pngCanvas::output(const char* outfilename, int frame)
 
         png_write_info(png_ptr, info_ptr);
 
-        png_bytep rowPtr = mData.get() + srcy * mStride + srcx * aggCanvas::BytesPerPixel.at(mPixelFormat);
+        png_const_bytep rowPtr = data;
         for (int r = 0; r < height; ++r) {
-            if (mPixelFormat == aggCanvas::RGBA8_Blend) {
-                // Convert each row to non-premultiplied alpha as per PNG spec
-                // This is done in a separate array instead of in-situ because
-                // for animations the main buffer might be drawn into again
-                for (int c = 0; c < width * 4; c += 4) {
-                    agg::rgba8 pix(rowPtr[c + 0], rowPtr[c + 1], rowPtr[c + 2], rowPtr[c + 3]);
-                    pix.demultiply();
-                    row[c + 0] = pix.r; 
-                    row[c + 1] = pix.g;
-                    row[c + 2] = pix.b; 
-                    row[c + 3] = pix.a;
-                }
-                png_write_row(png_ptr, row.get());
-            } else if (mPixelFormat == aggCanvas::RGBA16_Blend) {
-                // Ditto for rgba16
-                png_uint_16p rowPtr16 = reinterpret_cast<png_uint_16p>(rowPtr);
-                for (int c = 0; c < width * 4; c += 4) {
-                    agg::rgba16 pix(rowPtr16[c + 0], rowPtr16[c + 1], rowPtr16[c + 2], rowPtr16[c + 3]);
-                    pix.demultiply();
-                    row16[c + 0] = htons(pix.r);    // Also convert to network byte order
-                    row16[c + 1] = htons(pix.g);
-                    row16[c + 2] = htons(pix.b); 
-                    row16[c + 3] = htons(pix.a);
-                }
-                png_write_row(png_ptr, reinterpret_cast<png_bytep>(row16.get()));
-            } else if (mPixelFormat & Has_16bit_Color) {
-                // Convert rgb16/gray16 to network byte order
-                png_uint_16p rowPtr16 = reinterpret_cast<png_uint_16p>(rowPtr);
-                for (int c = 0; c < width * (BytesPerPixel.at(mPixelFormat) >> 1); ++c) 
-                    row16[c] = htons(rowPtr16[c]);
-                png_write_row(png_ptr, reinterpret_cast<png_bytep>(row16.get()));
-            } else {
-                png_write_row(png_ptr, rowPtr);
-            }
+            png_write_row(png_ptr, const_cast<png_bytep>(pngRow(rowPtr, row.get(), width)));
             rowPtr += mStride;
         }
 
@@ -195,3 +345,326 @@ void pngCanvas::output(const char* outfilename, int frame)
 }
 
 
+
+const unsigned char*
+pngCanvas::pngRow(const unsigned char* src, unsigned char* dst, int width) const
+{
+    switch (mPixelFormat) {
+        case aggCanvas::RGBA8_Blend:
+            // Convert to non-premultiplied alpha as per PNG spec. This is
+            // done in a separate array instead of in-situ because for
+            // animations the main buffer might be drawn into again
+            for (int c = 0; c < width * 4; c += 4) {
+                agg::rgba8 pix(src[c + 0], src[c + 1], src[c + 2], src[c + 3]);
+                pix.demultiply();
+                dst[c + 0] = pix.r;
+                dst[c + 1] = pix.g;
+                dst[c + 2] = pix.b;
+                dst[c + 3] = pix.a;
+            }
+            return dst;
+        case aggCanvas::RGBA16_Blend: {
+            // Ditto for rgba16, also convert to network byte order
+            const png_uint_16* src16 = reinterpret_cast<const png_uint_16*>(src);
+            png_uint_16* dst16 = reinterpret_cast<png_uint_16*>(dst);
+            for (int c = 0; c < width * 4; c += 4) {
+                agg::rgba16 pix(src16[c + 0], src16[c + 1], src16[c + 2], src16[c + 3]);
+                pix.demultiply();
+                dst16[c + 0] = htons(pix.r);
+                dst16[c + 1] = htons(pix.g);
+                dst16[c + 2] = htons(pix.b);
+                dst16[c + 3] = htons(pix.a);
+            }
+            return dst;
+        }
+        case aggCanvas::RGB16_Blend:
+        case aggCanvas::Gray16_Blend: {
+            // Convert rgb16/gray16 to network byte order
+            const png_uint_16* src16 = reinterpret_cast<const png_uint_16*>(src);
+            png_uint_16* dst16 = reinterpret_cast<png_uint_16*>(dst);
+            for (int c = 0; c < width * (BytesPerPixel.at(mPixelFormat) >> 1); ++c)
+                dst16[c] = htons(src16[c]);
+            return dst;
+        }
+        default:
+            return src;
+    }
+}
+
+namespace {
+    inline int
+    paethPredictor(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        return pb <= pc ? b : c;
+    }
+
+    // Applies PNG filter type (0-4) to row, given the previous unfiltered
+    // row. out gets the filter type byte and then the filtered bytes.
+    void
+    filterRow(int type, const unsigned char* row, const unsigned char* prev,
+              size_t length, size_t bpp, unsigned char* out)
+    {
+        *out++ = static_cast<unsigned char>(type);
+        size_t i = 0;
+        switch (type) {
+            case 0:
+                memcpy(out, row, length);
+                break;
+            case 1:
+                for (; i < bpp; ++i) out[i] = row[i];
+                for (; i < length; ++i) out[i] = row[i] - row[i - bpp];
+                break;
+            case 2:
+                for (; i < length; ++i) out[i] = row[i] - prev[i];
+                break;
+            case 3:
+                for (; i < bpp; ++i) out[i] = row[i] - (prev[i] >> 1);
+                for (; i < length; ++i) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+                break;
+            case 4:
+                for (; i < bpp; ++i) out[i] = row[i] - prev[i];
+                for (; i < length; ++i)
+                    out[i] = row[i] - paethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+                break;
+        }
+    }
+
+    // Filters a row with each of the allowed filters (PNG_FILTER_* flags)
+    // and keeps the one with the smallest sum of absolute values of the
+    // filtered bytes as signed bytes, the same heuristic as libpng.
+    // scratch has room for two filtered rows. Returns the filtered row.
+    const unsigned char*
+    filterRowAdaptive(int allowed, const unsigned char* row, const unsigned char* prev,
+                      size_t length, size_t bpp, unsigned char* scratch)
+    {
+        unsigned char* best = nullptr;
+        unsigned char* trial = scratch;
+        unsigned long bestSum = ULONG_MAX;
+        for (int type = 0; type < 5; ++type) {
+            if (!(allowed & (PNG_FILTER_NONE << type)))
+                continue;
+            filterRow(type, row, prev, length, bpp, trial);
+            if (allowed == (PNG_FILTER_NONE << type))
+                return trial;
+            unsigned long sum = 0;
+            for (size_t i = 1; i <= length; ++i)
+                sum += trial[i] < 128 ? trial[i] : 256 - trial[i];
+            if (sum < bestSum) {
+                bestSum = sum;
+                std::swap(best, trial);
+                if (!trial)
+                    trial = scratch + length + 1;
+            }
+        }
+        return best;
+    }
+
+    void
+    putBigEndian(unsigned char* p, unsigned long v)
+    {
+        p[0] = static_cast<unsigned char>(v >> 24);
+        p[1] = static_cast<unsigned char>(v >> 16);
+        p[2] = static_cast<unsigned char>(v >> 8);
+        p[3] = static_cast<unsigned char>(v);
+    }
+
+    bool
+    writeChunk(FILE* out, const char* type, const unsigned char* data, size_t length)
+    {
+        unsigned char header[8];
+        putBigEndian(header, static_cast<unsigned long>(length));
+        memcpy(header + 4, type, 4);
+        uLong crc = crc32(0, header + 4, 4);
+        if (length)
+            crc = crc32(crc, data, static_cast<uInt>(length));
+        unsigned char trailer[4];
+        putBigEndian(trailer, crc);
+        return fwrite(header, 1, 8, out) == 8 &&
+               (!length || fwrite(data, 1, length, out) == length) &&
+               fwrite(trailer, 1, 4, out) == 4;
+    }
+}
+
+// Bands of rows are filtered and compressed as independent raw deflate
+// streams on a pool of threads, like pigz does. All but the last band end
+// with a sync flush so that they are byte aligned and not final, so the
+// bands can be concatenated into one zlib stream. Each band is primed with
+// the 32kB of filtered data before it as its dictionary, so the output is
+// nearly as small as a single stream. The bands are written in order as
+// they are finished, with a bounded number in flight.
+bool
+pngCanvas::writeParallel(FILE* out, const unsigned char* data, int width, int height,
+                         int colorType, unsigned threads)
+{
+    const size_t bpp = BytesPerPixel.at(mPixelFormat);
+    const size_t rowBytes = width * bpp;
+    const size_t filteredBytes = rowBytes + 1;
+    const int level = mCompression >= 0 ? mCompression : Z_DEFAULT_COMPRESSION;
+    const int allowed = mFilters >= 0 ? mFilters : PNG_ALL_FILTERS;
+    const int strategy = allowed == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    const int bandRows = static_cast<int>(std::max<size_t>(1, BandBytes / filteredBytes));
+    const int bandCount = (height + bandRows - 1) / bandRows;
+    const int dictRows = static_cast<int>((DictionaryBytes + filteredBytes - 1) / filteredBytes);
+    const unsigned window = 2 * threads;
+
+    struct Band {
+        std::vector<unsigned char> mDeflated;
+        uLong   mAdler = 1;
+        size_t  mLength = 0;
+        bool    mDone = false;
+        bool    mFailed = false;
+    };
+    std::vector<Band> bands(bandCount);
+    std::mutex bandMutex;
+    std::condition_variable bandDone, bandWritten;
+    int nextBand = 0, writtenBands = 0;
+
+    // Filters rows [first, last) and passes each filtered row to f
+    auto filterRows = [&](int first, int last, unsigned char* convert,
+                          unsigned char* prevConvert, unsigned char* scratch, auto f)
+    {
+        std::vector<unsigned char> zeros;
+        const unsigned char* prev;
+        if (first > 0) {
+            prev = pngRow(data + (first - 1) * static_cast<size_t>(mStride), prevConvert, width);
+        } else {
+            zeros.assign(rowBytes, 0);
+            prev = zeros.data();
+        }
+        for (int r = first; r < last; ++r) {
+            const unsigned char* row = pngRow(data + r * static_cast<size_t>(mStride),
+                                              convert, width);
+            f(filterRowAdaptive(allowed, row, prev, rowBytes, bpp, scratch));
+            if (row == convert) {
+                std::swap(convert, prevConvert);
+                prev = prevConvert;
+            } else {
+                prev = row;
+            }
+        }
+    };
+
+    auto compressBand = [&](int b, Band& band) {
+        std::vector<unsigned char> convert(2 * rowBytes), scratch(2 * filteredBytes);
+        int first = b * bandRows;
+        int last = std::min(height, first + bandRows);
+
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+            return false;
+
+        bool ok = true;
+        if (first > 0 && level != 0) {
+            std::vector<unsigned char> dict;
+            filterRows(std::max(0, first - dictRows), first, convert.data(),
+                       convert.data() + rowBytes, scratch.data(),
+                       [&](const unsigned char* f) { dict.insert(dict.end(), f, f + filteredBytes); });
+            size_t n = std::min<size_t>(dict.size(), DictionaryBytes);
+            ok = deflateSetDictionary(&strm, dict.data() + dict.size() - n,
+                                      static_cast<uInt>(n)) == Z_OK;
+        }
+
+        auto deflateSome = [&](const unsigned char* in, size_t length, int flush) {
+            strm.next_in = const_cast<Bytef*>(in);
+            strm.avail_in = static_cast<uInt>(length);
+            do {
+                size_t have = band.mDeflated.size();
+                band.mDeflated.resize(have + deflateBound(&strm, strm.avail_in) + 16);
+                strm.next_out = band.mDeflated.data() + have;
+                strm.avail_out = static_cast<uInt>(band.mDeflated.size() - have);
+                int ret = deflate(&strm, flush);
+                band.mDeflated.resize(band.mDeflated.size() - strm.avail_out);
+                if (ret == Z_STREAM_ERROR)
+                    return false;
+            } while (strm.avail_out == 0 || strm.avail_in);
+            return true;
+        };
+
+        filterRows(first, last, convert.data(), convert.data() + rowBytes, scratch.data(),
+                   [&](const unsigned char* f) {
+            band.mAdler = adler32(band.mAdler, f, static_cast<uInt>(filteredBytes));
+            band.mLength += filteredBytes;
+            ok = ok && deflateSome(f, filteredBytes, Z_NO_FLUSH);
+        });
+        ok = ok && deflateSome(nullptr, 0, b == bandCount - 1 ? Z_FINISH : Z_SYNC_FLUSH);
+        deflateEnd(&strm);
+        return ok;
+    };
+
+    auto worker = [&]() {
+        for (;;) {
+            int b;
+            {
+                std::unique_lock<std::mutex> lock(bandMutex);
+                bandWritten.wait(lock, [&]() {
+                    return nextBand >= bandCount || nextBand < writtenBands + static_cast<int>(window);
+                });
+                if (nextBand >= bandCount)
+                    return;
+                b = nextBand++;
+            }
+            bool ok = compressBand(b, bands[b]);
+            std::lock_guard<std::mutex> lock(bandMutex);
+            bands[b].mFailed = !ok;
+            bands[b].mDone = true;
+            bandDone.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i)
+        pool.emplace_back(worker);
+
+    // Signature, header and comment
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    unsigned char ihdr[13];
+    putBigEndian(ihdr, width);
+    putBigEndian(ihdr + 4, height);
+    ihdr[8] = (mPixelFormat & Has_16bit_Color) + 8;
+    ihdr[9] = static_cast<unsigned char>(colorType);
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;     // deflate, adaptive filtering, no interlace
+    static const char software[] = "Software\0Context Free";
+    bool ok = fwrite(signature, 1, 8, out) == 8 &&
+              writeChunk(out, "IHDR", ihdr, 13) &&
+              writeChunk(out, "tEXt", reinterpret_cast<const unsigned char*>(software),
+                         sizeof(software) - 1);
+
+    // zlib header, then the bands, then the Adler-32 of all the filtered data
+    int flevel = level == Z_DEFAULT_COMPRESSION ? 2 : level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    unsigned zheader = 0x7800 | (flevel << 6);
+    zheader += 31 - zheader % 31;
+    uLong adler = 1;
+    for (int b = 0; b < bandCount; ++b) {
+        {
+            std::unique_lock<std::mutex> lock(bandMutex);
+            bandDone.wait(lock, [&]() { return bands[b].mDone; });
+        }
+        Band& band = bands[b];
+        ok = ok && !band.mFailed;
+        adler = adler32_combine(adler, band.mAdler, static_cast<z_off_t>(band.mLength));
+        if (b == 0) {
+            band.mDeflated.insert(band.mDeflated.begin(),
+                                  {static_cast<unsigned char>(zheader >> 8),
+                                   static_cast<unsigned char>(zheader)});
+        }
+        if (b == bandCount - 1) {
+            unsigned char trailer[4];
+            putBigEndian(trailer, adler);
+            band.mDeflated.insert(band.mDeflated.end(), trailer, trailer + 4);
+        }
+        ok = ok && writeChunk(out, "IDAT", band.mDeflated.data(), band.mDeflated.size());
+        std::vector<unsigned char>().swap(band.mDeflated);
+
+        std::lock_guard<std::mutex> lock(bandMutex);
+        ++writtenBands;
+        bandWritten.notify_all();
+    }
+    for (std::thread& t: pool)
+        t.join();
+
+    return writeChunk(out, "IEND", nullptr, 0) && ok && fflush(out) == 0;
+}
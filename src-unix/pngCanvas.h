@@ -27,18 +27,55 @@
 //
 
 #include "abstractPngCanvas.h"
+#include <string>
+#include <memory>
+#include <cstdio>
 
 class pngCanvas : public abstractPngCanvas
 {
 public:
     pngCanvas(const char* outfilename, bool quiet, int width, int height, 
               PixelFormat pixfmt, bool crop, int frameCount, int variation,
-              bool wallpaper, Renderer *r, int mx, int my)
-    : abstractPngCanvas(outfilename, quiet, width, height, pixfmt, crop,
-                        frameCount, variation, wallpaper, r, mx, my)
-    {
-    }
+              bool wallpaper, Renderer *r, int mx, int my);
+    ~pngCanvas() override;
+    
+    // Write the encoded PNG into a string instead of the output file
+    void outputToMemory(std::string* dest) { mMemoryOutput = dest; }
+
+    // Set the zlib compression level (0-9) and the PNG_FILTER_* row filters
+    // to try, -1 keeps the libpng default
+    void setCompression(int level, int filters)
+    { mCompression = level; mFilters = filters; }
+    static bool FiltersFromName(const char* name, int& filters);
+        // none, sub, up, avg, paeth, or all
+
+    // Number of threads that compress a single image, 0 picks a number for
+    // large images, 1 always uses libpng
+    void setEncoderThreads(unsigned threads) { mThreads = threads; }
 protected:
     void output(const char * outfilename, int frame = -1) override;
+private:
+    std::string* mMemoryOutput;
+    int mCompression;
+    int mFilters;
+    unsigned mThreads;
+
+    // Animation frames are encoded on other threads
+    class Encoder;
+    std::unique_ptr<Encoder> mEncoder;
+    void encode(const char* outfilename, int frame, const unsigned char* data,
+                int width, int height);
+
+    // Large images are split into bands that are compressed in parallel
+    enum : size_t {
+        ParallelPixels = 4 << 20,       // automatic threads at this size
+        BandBytes = 512 << 10,          // raw image data per band
+        DictionaryBytes = 32 << 10      // deflate window
+    };
+    bool writeParallel(FILE* out, const unsigned char* data, int width, int height,
+                       int colorType, unsigned threads);
+    const unsigned char* pngRow(const unsigned char* src, unsigned char* dst,
+                                int width) const;
+        // returns the row in PNG byte order, converted into dst if needed
 };
 
@@ -171,6 +171,22 @@ PosixSystem::tempFileForWrite(AbstractSystem::TempType tt, string& nameOut)
     return f;
 }
 
+bool
+PosixSystem::fileStamp(const string& path, FileStamp& stamp)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) || !S_ISREG(sb.st_mode))
+        return false;
+#ifdef __APPLE__
+    const struct timespec& mtime = sb.st_mtimespec;
+#else
+    const struct timespec& mtime = sb.st_mtim;
+#endif
+    stamp.size = static_cast<uint64_t>(sb.st_size);
+    stamp.mtime = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+    return true;
+}
+
 string
 PosixSystem::relativeFilePath(const string& base, const string& rel)
 {
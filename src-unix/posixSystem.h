@@ -47,6 +47,7 @@ public:
     
     std::string relativeFilePath(
         const std::string& base, const std::string& rel) override;
+    bool fileStamp(const std::string& path, FileStamp& stamp) override;
     size_t getPhysicalMemory() override;
 };
 
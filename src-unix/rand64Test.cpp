@@ -0,0 +1,82 @@
+// rand64Test.cpp
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+// Checks that the batch sampling functions in Rand64 return exactly the
+// samples that the single-sample functions return, and leave the seed in
+// the same state.
+
+#include "Rand64.h"
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <functional>
+
+using namespace std;
+
+namespace {
+    int Failures = 0;
+
+    void
+    check(const char* name, Rand64::result_type seed, size_t n,
+          function<double(Rand64&)> single,
+          function<void(Rand64&, double*, size_t)> batch)
+    {
+        Rand64 a(seed), b(seed);
+        vector<double> expected(n), actual(n);
+        for (auto& x: expected)
+            x = single(a);
+        batch(b, actual.data(), n);
+        bool same = memcmp(expected.data(), actual.data(), n * sizeof(double)) == 0;
+        if (!same || a() != b()) {
+            cerr << name << " differs from the single-sample version with seed "
+                 << seed << ", " << n << " samples" << endl;
+            ++Failures;
+        }
+    }
+}
+
+int
+main()
+{
+    const Rand64::result_type seeds[] = { 1, 0x123456789abcdefULL, ~0ULL };
+    const size_t counts[] = { 0, 1, 2, 63, 64, 65, 127, 1000 };
+
+    for (auto seed: seeds) {
+        for (auto n: counts) {
+            check("getDoubles", seed, n,
+                  [](Rand64& r) { return r.getDouble(); },
+                  [](Rand64& r, double* out, size_t n) { r.getDoubles(out, n); });
+            check("getExponentials", seed, n,
+                  [](Rand64& r) { return r.getExponential(1.5); },
+                  [](Rand64& r, double* out, size_t n) { r.getExponentials(1.5, out, n); });
+            check("getNormals", seed, n,
+                  [](Rand64& r) { return r.getNormal(3.0, 0.25); },
+                  [](Rand64& r, double* out, size_t n) { r.getNormals(3.0, 0.25, out, n); });
+        }
+    }
+
+    if (Failures == 0)
+        cout << "Rand64 batch sampling   pass" << endl;
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// renderClient.cpp
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+// A minimal client for the render server, for testing it from scripts:
+//
+//      cfdg-client SOCKET [KEY VALUE]... > image
+//
+// The keys are sent as the request header (see renderServer.h). If there is
+// no path key then the cfdg text is read from standard input. The image is
+// written to standard output and errors to standard error.
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+    bool
+    writeAll(int fd, const char* data, size_t length)
+    {
+        while (length) {
+            ssize_t n = ::write(fd, data, length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 2 || argc % 2 != 0) {
+        cerr << "usage: cfdg-client SOCKET [KEY VALUE]..." << endl;
+        return 2;
+    }
+
+    string header, text;
+    bool hasPath = false;
+    for (int i = 2; i < argc; i += 2) {
+        header.append(argv[i]).append(" ").append(argv[i + 1]).push_back('\n');
+        hasPath = hasPath || strcmp(argv[i], "path") == 0;
+    }
+    if (!hasPath) {
+        ostringstream ss;
+        ss << cin.rdbuf();
+        text = ss.str();
+        header.append("length ").append(to_string(text.length())).push_back('\n');
+    }
+    header.push_back('\n');
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        cerr << "Invalid socket path: " << argv[1] << endl;
+        return 2;
+    }
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        cerr << "Couldn't connect to " << argv[1] << ": " << strerror(errno) << endl;
+        return 7;
+    }
+    if (!writeAll(fd, header.data(), header.length()) ||
+        !writeAll(fd, text.data(), text.length()))
+    {
+        cerr << "Couldn't send the request" << endl;
+        return 7;
+    }
+
+    string response;
+    char chunk[65536];
+    for (;;) {
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        response.append(chunk, static_cast<size_t>(n));
+    }
+    ::close(fd);
+
+    size_t eol = response.find('\n');
+    if (eol == string::npos) {
+        cerr << "Incomplete response" << endl;
+        return 7;
+    }
+    if (response.compare(0, 3, "OK ") != 0) {
+        cerr << response.substr(0, eol) << endl;
+        return 1;
+    }
+    size_t length = strtoul(response.c_str() + response.rfind(' ', eol) + 1, nullptr, 10);
+    if (response.length() - eol - 1 != length) {
+        cerr << "Incomplete image" << endl;
+        return 7;
+    }
+    cout.write(response.data() + eol + 1, static_cast<streamsize>(length));
+    return cout ? 0 : 7;
+}
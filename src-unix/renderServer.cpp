@@ -0,0 +1,405 @@
+// renderServer.cpp
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+#include "renderServer.h"
+#include "variation.h"
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <climits>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+using namespace std;
+
+RenderServer* RenderServer::CurrentServer = nullptr;
+
+namespace {
+    const size_t MaxTextLength = 16 << 20;
+
+    bool
+    writeAll(int fd, const char* data, size_t length)
+    {
+        while (length) {
+            ssize_t n = ::write(fd, data, length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+struct RenderServer::Request {
+    string  path;
+    string  text;
+    bool    svg = false;
+    libcfdg::RenderOptions options;
+};
+
+RenderServer::RenderServer(const string& socketPath, const string& root,
+                           unsigned workers, size_t cacheSize)
+: mSocketPath(socketPath), mRoot(root), mWorkerCount(workers ? workers : 1),
+  mCacheSize(cacheSize ? cacheSize : 1), mSocket(-1), mStop(false)
+{
+}
+
+RenderServer::~RenderServer()
+{
+    if (mSocket >= 0) {
+        ::close(mSocket);
+        ::unlink(mSocketPath.c_str());
+    }
+}
+
+int
+RenderServer::run()
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (mSocketPath.empty() || mSocketPath.length() >= sizeof(addr.sun_path)) {
+        cerr << "Invalid socket path: " << mSocketPath << endl;
+        return 2;
+    }
+    strncpy(addr.sun_path, mSocketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (!mRoot.empty()) {
+        char resolved[PATH_MAX];
+        struct stat sb;
+        if (!::realpath(mRoot.c_str(), resolved) || ::stat(resolved, &sb) ||
+            !S_ISDIR(sb.st_mode))
+        {
+            cerr << "Invalid root directory: " << mRoot << endl;
+            return 2;
+        }
+        mRoot = resolved;
+        if (mRoot.back() != '/')
+            mRoot.push_back('/');
+    }
+
+    mSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mSocket < 0) {
+        cerr << "Couldn't create socket: " << strerror(errno) << endl;
+        return 7;
+    }
+    ::unlink(mSocketPath.c_str());
+    // The socket file gets its permissions from the umask. There are no
+    // other threads yet, so changing it briefly is safe.
+    mode_t oldMask = ::umask(077);
+    int bound = ::bind(mSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    ::umask(oldMask);
+    if (bound < 0 || ::listen(mSocket, 64) < 0)
+    {
+        cerr << "Couldn't listen on " << mSocketPath << ": " << strerror(errno) << endl;
+        ::close(mSocket);
+        mSocket = -1;
+        return 7;
+    }
+
+    // Interrupts must be handled by this thread so that accept() is
+    // interrupted, so block them in the worker threads.
+    sigset_t blocked, old;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigaddset(&blocked, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &blocked, &old);
+    vector<thread> workers;
+    for (unsigned i = 0; i < mWorkerCount; ++i)
+        workers.emplace_back(&RenderServer::worker, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    while (!mStop) {
+        int fd = ::accept(mSocket, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            cerr << "Socket error: " << strerror(errno) << endl;
+            break;
+        }
+        lock_guard<mutex> lock(mQueueMutex);
+        mQueue.push_back(fd);
+        mQueueReady.notify_one();
+    }
+
+    mStop = true;
+    mQueueReady.notify_all();
+    for (thread& t: workers)
+        t.join();
+    return 0;
+}
+
+void
+RenderServer::worker()
+{
+    for (;;) {
+        int fd;
+        {
+            unique_lock<mutex> lock(mQueueMutex);
+            mQueueReady.wait(lock, [this]() { return mStop || !mQueue.empty(); });
+            if (mQueue.empty())
+                return;
+            fd = mQueue.front();
+            mQueue.pop_front();
+        }
+        serve(fd);
+        ::close(fd);
+    }
+}
+
+void
+RenderServer::serve(int fd)
+{
+    Request req;
+    string err, image;
+    design_ptr d;
+
+    if (readRequest(fd, req, err) && (d = getDesign(req, err)) &&
+        render(req, d, image, err))
+    {
+        string header = string("OK ") + (req.svg ? "svg " : "png ") +
+                        to_string(image.length()) + "\n";
+        if (writeAll(fd, header.data(), header.length()))
+            writeAll(fd, image.data(), image.length());
+    } else {
+        for (char& c: err)
+            if (c == '\n') c = ' ';
+        string response = "ERROR " + err + "\n";
+        writeAll(fd, response.data(), response.length());
+    }
+}
+
+bool
+RenderServer::readRequest(int fd, Request& req, string& err)
+{
+    string buf;
+    size_t headerEnd;
+    char chunk[4096];
+
+    while ((headerEnd = buf.find("\n\n")) == string::npos) {
+        if (buf.length() > 65536) {
+            err = "Request header is too long";
+            return false;
+        }
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            err = "Incomplete request";
+            return false;
+        }
+        buf.append(chunk, static_cast<size_t>(n));
+    }
+
+    istringstream header(buf.substr(0, headerEnd));
+    buf.erase(0, headerEnd + 2);
+
+    size_t length = 0;
+    bool hasLength = false;
+    string line;
+    while (getline(header, line)) {
+        istringstream fields(line);
+        string key, value;
+        fields >> key;
+        getline(fields >> ws, value);
+        if (key.empty()) continue;
+
+        if (key == "path") {
+            if (!resolvePath(value, req.path, err))
+                return false;
+        } else if (key == "length") {
+            length = strtoul(value.c_str(), nullptr, 10);
+            hasLength = true;
+            if (length > MaxTextLength) {
+                err = "The cfdg text is too long";
+                return false;
+            }
+        } else if (key == "variation") {
+            req.options.variation = Variation::fromString(value.c_str());
+            if (req.options.variation < 1) {
+                err = "Error parsing variation";
+                return false;
+            }
+        } else if (key == "size") {
+            char* end;
+            long w = strtol(value.c_str(), &end, 10);
+            long h = *end == 'x' ? strtol(end + 1, &end, 10) : w;
+            if (w < 10 || h < 10 || w > 65536 || h > 65536) {
+                err = "Output size must be between 10 and 65536 pixels";
+                return false;
+            }
+            req.options.width = static_cast<int>(w);
+            req.options.height = static_cast<int>(h);
+        } else if (key == "format") {
+            if (value != "png" && value != "svg") {
+                err = "Unknown output format " + value;
+                return false;
+            }
+            req.svg = value == "svg";
+        } else if (key == "minsize") {
+            req.options.minSize = atof(value.c_str());
+        } else if (key == "border") {
+            req.options.border = atof(value.c_str());
+            if (req.options.border < -1.0 || req.options.border > 2.0) {
+                err = "Border size must be between -1 and 2";
+                return false;
+            }
+        } else if (key == "maxshapes") {
+            req.options.maxShapes = atoi(value.c_str());
+        } else if (key == "crop") {
+            req.options.crop = atoi(value.c_str()) != 0;
+        } else if (key == "legacy") {
+            req.options.legacyOrder = atoi(value.c_str()) != 0;
+        } else if (key == "cull") {
+            req.options.cull = atoi(value.c_str()) != 0;
+        } else if (key == "seeds") {
+            if (value != "legacy" && value != "split") {
+                err = "Seed derivation must be legacy or split";
+                return false;
+            }
+            req.options.splitSeeds = value == "split";
+        } else {
+            err = "Unknown request key " + key;
+            return false;
+        }
+    }
+
+    if (hasLength != req.path.empty()) {
+        err = "Request must have either a path or a length";
+        return false;
+    }
+
+    if (hasLength) {
+        while (buf.length() < length) {
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                err = "Incomplete cfdg text";
+                return false;
+            }
+            buf.append(chunk, static_cast<size_t>(n));
+        }
+        buf.resize(length);
+        req.text = std::move(buf);
+    } else {
+        ifstream file(req.path, ios::binary);
+        if (!file) {
+            err = "Couldn't open rules file " + req.path;
+            return false;
+        }
+        ostringstream text;
+        text << file.rdbuf();
+        req.text = text.str();
+    }
+    return true;
+}
+
+bool
+RenderServer::resolvePath(const string& path, string& resolved, string& err)
+{
+    if (mRoot.empty()) {
+        err = "This server does not read files";
+        return false;
+    }
+    string full = !path.empty() && path.front() == '/' ? path : mRoot + path;
+    char buf[PATH_MAX];
+    if (!::realpath(full.c_str(), buf) ||
+        strncmp(buf, mRoot.c_str(), mRoot.length()) != 0)
+    {
+        // Don't say whether a file outside the root exists
+        err = "Couldn't open rules file " + path;
+        return false;
+    }
+    resolved = buf;
+    return true;
+}
+
+RenderServer::design_ptr
+RenderServer::getDesign(const Request& req, string& err)
+{
+    // Imports are relative to the cfdg file, so the path is part of the key
+    string name = req.path.empty() ? mRoot + "request.cfdg" : req.path;
+    size_t key = hash<string>()(name + '\0' + req.text);
+
+    design_ptr d;
+    {
+        lock_guard<mutex> lock(mCacheMutex);
+        auto it = mCacheIndex.find(key);
+        if (it != mCacheIndex.end() && it->second->mText == req.text) {
+            mCache.splice(mCache.begin(), mCache, it->second);
+            d = it->second->mDesign;
+        }
+    }
+    // The imported files are checked outside of the lock because it
+    // reads them. If one has changed then the design is parsed again
+    // and replaces the cached one.
+    if (d && !d->sourcesChanged())
+        return d;
+
+    try {
+        d = make_shared<libcfdg::Design>(req.text, req.options.variation, name,
+                                         mRoot.c_str());
+    } catch (libcfdg::Error& e) {
+        err = e.what();
+        return nullptr;
+    }
+
+    lock_guard<mutex> lock(mCacheMutex);
+    auto it = mCacheIndex.find(key);
+    if (it != mCacheIndex.end()) {
+        mCache.erase(it->second);
+        mCacheIndex.erase(it);
+    }
+    mCache.push_front(CacheEntry{key, req.text, d});
+    mCacheIndex[key] = mCache.begin();
+    if (mCache.size() > mCacheSize) {
+        mCacheIndex.erase(mCache.back().mKey);
+        mCache.pop_back();
+    }
+    return d;
+}
+
+bool
+RenderServer::render(const Request& req, const design_ptr& d,
+                     string& image, string& err)
+{
+    try {
+        image = req.svg ? d->renderSVG(req.options) : d->renderPNG(req.options);
+    } catch (libcfdg::Error& e) {
+        err = e.what();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,112 @@
+// renderServer.h
+// Context Free
+// ---------------------
+// Copyright (C) 2026 John Horigan - john@glyphic.com
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+// John Horigan can be contacted at john@glyphic.com or at
+// John Horigan, 1209 Villa St., Mountain View, CA 94041-1123, USA
+//
+//
+
+#ifndef INCLUDE_RENDERSERVER_H
+#define INCLUDE_RENDERSERVER_H
+
+#include <string>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "libcfdg.h"
+
+// A render daemon that accepts jobs on a Unix domain socket. Each connection
+// carries one job. The request is a list of "key value" lines ended by an
+// empty line:
+//
+//      path FILE           render the cfdg file FILE in the root directory, or
+//      length N            render the N bytes of cfdg text after the empty line
+//      variation CODE      variation code (default is A)
+//      size N or WxH       output size (default is 500x500)
+//      format png|svg      output format (default is png)
+//      minsize X           minimum shape size (default is 0.3)
+//      border X            border size [-1,2] (default is 2)
+//      maxshapes N         maximum number of shapes
+//      crop 0|1            crop the output
+//      legacy 0|1          expand shapes in the same order as earlier versions
+//      cull 0|1            skip shapes that can't reach the canvas of a sized
+//                          design
+//      seeds legacy|split  how child shapes get their random seeds (default
+//                          is legacy)
+//
+// The response is "OK png|svg LENGTH\n" followed by LENGTH bytes of image
+// data, or "ERROR message\n".
+//
+// Jobs can only read files inside the root directory given to the server,
+// both with the path key and with import statements. Without a root they
+// can't read any files. The socket is only accessible to its owner.
+//
+// Parsed designs are kept in an LRU cache keyed by a hash of the cfdg text,
+// so repeated jobs for a design only pay for rendering.
+
+class RenderServer {
+public:
+    RenderServer(const std::string& socketPath, const std::string& root,
+                 unsigned workers, size_t cacheSize = 16);
+    ~RenderServer();
+
+    int run();          // returns when stop() is called
+    void stop() { mStop = true; }
+
+    static RenderServer* CurrentServer;
+
+private:
+    struct Request;
+    using design_ptr = std::shared_ptr<libcfdg::Design>;
+    struct CacheEntry {
+        size_t      mKey;
+        std::string mText;
+        design_ptr  mDesign;
+    };
+
+    std::string mSocketPath;
+    std::string mRoot;          // with a trailing slash, empty if no files
+    unsigned    mWorkerCount;
+    size_t      mCacheSize;
+    int         mSocket;
+    std::atomic<bool> mStop;
+
+    std::mutex              mQueueMutex;
+    std::condition_variable mQueueReady;
+    std::deque<int>         mQueue;
+
+    std::mutex              mCacheMutex;
+    std::list<CacheEntry>   mCache;         // most recently used first
+    std::unordered_map<size_t, std::list<CacheEntry>::iterator> mCacheIndex;
+
+    void worker();
+    void serve(int fd);
+    bool readRequest(int fd, Request& req, std::string& err);
+    bool resolvePath(const std::string& path, std::string& resolved,
+                     std::string& err);
+    design_ptr getDesign(const Request& req, std::string& err);
+    bool render(const Request& req, const design_ptr& d,
+                std::string& image, std::string& err);
+};
+
+#endif // INCLUDE_RENDERSERVER_H